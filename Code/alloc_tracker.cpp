@@ -0,0 +1,60 @@
+// Replacement global operator new/delete for allocation attribution, compiled only with
+// -DPROFILER_TRACK_ALLOCATIONS (make PROFILER_FLAGS=-DPROFILER_TRACK_ALLOCATIONS). Until
+// Profiler::SetAllocationTracking(true) they cost one relaxed load on top of malloc/free.
+// Nothing here may allocate, since any allocation would re-enter these operators.
+
+#ifdef PROFILER_TRACK_ALLOCATIONS
+
+#include "profiler.hpp"
+
+#include <cstdlib>
+#include <new>
+
+namespace {
+    void* TrackedAllocate(std::size_t size)
+    {
+        void* block = malloc(size ? size : 1);
+        if (block && Profiler::allocationTracking.load(std::memory_order_relaxed)) {
+            Profiler::RecordAllocation(size);
+        }
+        return block;
+    }
+
+    void TrackedFree(void* block)
+    {
+        if (block && Profiler::allocationTracking.load(std::memory_order_relaxed)) {
+            Profiler::RecordFree();
+        }
+        free(block);
+    }
+
+    // Throwing forms follow the standard: retry through the new_handler, else bad_alloc
+    void* TrackedAllocateOrThrow(std::size_t size)
+    {
+        for (;;) {
+            void* block = TrackedAllocate(size);
+            if (block) {
+                return block;
+            }
+            std::new_handler handler = std::get_new_handler();
+            if (!handler) {
+                throw std::bad_alloc();
+            }
+            handler();
+        }
+    }
+}
+
+void* operator new(std::size_t size) { return TrackedAllocateOrThrow(size); }
+void* operator new[](std::size_t size) { return TrackedAllocateOrThrow(size); }
+void* operator new(std::size_t size, std::nothrow_t const&) noexcept { return TrackedAllocate(size); }
+void* operator new[](std::size_t size, std::nothrow_t const&) noexcept { return TrackedAllocate(size); }
+
+void operator delete(void* block) noexcept { TrackedFree(block); }
+void operator delete[](void* block) noexcept { TrackedFree(block); }
+void operator delete(void* block, std::nothrow_t const&) noexcept { TrackedFree(block); }
+void operator delete[](void* block, std::nothrow_t const&) noexcept { TrackedFree(block); }
+void operator delete(void* block, std::size_t) noexcept { TrackedFree(block); }
+void operator delete[](void* block, std::size_t) noexcept { TrackedFree(block); }
+
+#endif // PROFILER_TRACK_ALLOCATIONS
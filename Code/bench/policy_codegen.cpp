@@ -0,0 +1,19 @@
+// Kernel for `make codegen-check`. Every profiler macro sits on a line of its own, so deleting the
+// lines that mention them gives the uninstrumented baseline; built with PROFILER_POLICY=0 the
+// instrumented version must compile to the same assembly.
+
+#include "profiler.hpp"
+
+#include <cmath>
+
+float SumOfSines(float const* angles, int count)
+{
+    PROFILER_SCOPE("Sum Of Sines");
+    float sum = 0.f;
+    for (int i = 0; i < count; ++i) {
+        PROFILER_ENTER("Sine");
+        sum += sinf(angles[i]);
+        PROFILER_EXIT("Sine");
+    }
+    return sum;
+}
@@ -0,0 +1,283 @@
+// Measures what instrumentation costs: nanoseconds per enter/exit pair for each profiler API,
+// across nesting depths, numbers of distinct sections and thread counts. Build with `make bench`.
+//
+//   ./profiler_bench [--iterations N] [--json results.json]
+//
+// Results are printed as a table and, with --json, written as one object per configuration so
+// runs from different versions can be diffed.
+
+#include "profiler.hpp"
+#include "time.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+    struct BenchResult {
+        std::string api;
+        int depth;
+        int sections;
+        int threads;
+        long long iterations;
+        double nsPerPair;
+        double pairsPerSecond;
+    };
+
+    std::vector<BenchResult> results;
+
+    double SecondsSince(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void Report(const char* api, int depth, int sections, int threads, long long iterations, double seconds)
+    {
+        BenchResult result;
+        result.api = api;
+        result.depth = depth;
+        result.sections = sections;
+        result.threads = threads;
+        result.iterations = iterations;
+        result.nsPerPair = 1e9 * seconds / double(iterations);                     // Wall time per pair seen by each thread
+        result.pairsPerSecond = double(iterations * threads) / seconds;             // Aggregate throughput
+        results.push_back(result);
+
+        printf("%-28s depth=%-3d sections=%-4d threads=%-3d %8.2f ns/pair %10.2f Mpairs/s\n",
+               api, depth, sections, threads, result.nsPerPair, result.pairsPerSecond / 1e6);
+    }
+
+    // Enters depth - 1 enclosing sections, runs body, and leaves them again
+    template <typename Body>
+    void AtDepth(int depth, std::vector<int> const& enclosing, Body body)
+    {
+        Profiler* profiler = Profiler::GetInstance();
+        for (int level = 0; level < depth - 1; ++level) {
+            profiler->EnterSection(enclosing[level]);
+        }
+        body();
+        for (int level = depth - 2; level >= 0; --level) {
+            profiler->ExitSection(enclosing[level]);
+        }
+    }
+
+    volatile int sink = 0;
+
+    void BenchBaseline(long long iterations)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (long long i = 0; i < iterations; ++i) {
+            sink = sink + 1; // Stand-in for the instrumented body, so the loop itself is measured
+        }
+        Report("baseline (no profiling)", 1, 0, 1, iterations, SecondsSince(start));
+    }
+
+    void BenchMacros(long long iterations, int depth, std::vector<int> const& enclosing)
+    {
+        AtDepth(depth, enclosing, [&]() {
+            auto start = std::chrono::steady_clock::now();
+            for (long long i = 0; i < iterations; ++i) {
+                PROFILER_ENTER("Bench Macro");
+                sink = sink + 1;
+                PROFILER_EXIT("Bench Macro");
+            }
+            Report("PROFILER_ENTER/EXIT", depth, 1, 1, iterations, SecondsSince(start));
+        });
+    }
+
+    // What PROFILER_EXIT compiles to under PROFILER_POLICY_STATS; the policy is per translation unit,
+    // so the exit is called directly here
+    void BenchStatsPolicy(long long iterations, int depth, std::vector<int> const& enclosing)
+    {
+        AtDepth(depth, enclosing, [&]() {
+            auto start = std::chrono::steady_clock::now();
+            for (long long i = 0; i < iterations; ++i) {
+                static ProfilerCallSite const callSite("Bench Stats Policy", __FILE__, __FUNCTION__, __LINE__);
+                Profiler::GetInstance()->EnterSection(callSite);
+                sink = sink + 1;
+                Profiler::GetInstance()->ExitSectionAs<PROFILER_POLICY_STATS>(callSite.sectionId);
+            }
+            Report("PROFILER_* (stats policy)", depth, 1, 1, iterations, SecondsSince(start));
+        });
+    }
+
+    void BenchScopeMacro(long long iterations, int depth, std::vector<int> const& enclosing)
+    {
+        AtDepth(depth, enclosing, [&]() {
+            auto start = std::chrono::steady_clock::now();
+            for (long long i = 0; i < iterations; ++i) {
+                PROFILER_SCOPE("Bench Scope");
+                sink = sink + 1;
+            }
+            Report("PROFILER_SCOPE", depth, 1, 1, iterations, SecondsSince(start));
+        });
+    }
+
+    void BenchScopeObject(long long iterations, int depth, std::vector<int> const& enclosing)
+    {
+        AtDepth(depth, enclosing, [&]() {
+            auto start = std::chrono::steady_clock::now();
+            for (long long i = 0; i < iterations; ++i) {
+                ProfilerScopeObject scope("Bench Scope Object");
+                sink = sink + 1;
+            }
+            Report("ProfilerScopeObject(name)", depth, 1, 1, iterations, SecondsSince(start));
+        });
+    }
+
+    void BenchDirectByName(long long iterations, int depth, std::vector<int> const& enclosing)
+    {
+        Profiler* profiler = Profiler::GetInstance();
+        AtDepth(depth, enclosing, [&]() {
+            auto start = std::chrono::steady_clock::now();
+            for (long long i = 0; i < iterations; ++i) {
+                profiler->EnterSection("Bench Direct");
+                sink = sink + 1;
+                profiler->ExitSection("Bench Direct");
+            }
+            Report("EnterSection(name)", depth, 1, 1, iterations, SecondsSince(start));
+        });
+    }
+
+    void BenchDirectById(long long iterations, int depth, std::vector<int> const& sectionIds, std::vector<int> const& enclosing)
+    {
+        Profiler* profiler = Profiler::GetInstance();
+        int sectionCount = (int)sectionIds.size();
+        AtDepth(depth, enclosing, [&]() {
+            auto start = std::chrono::steady_clock::now();
+            for (long long i = 0; i < iterations; ++i) {
+                int sectionId = sectionIds[i % sectionCount];
+                profiler->EnterSection(sectionId);
+                sink = sink + 1;
+                profiler->ExitSection(sectionId);
+            }
+            Report("EnterSection(id)", depth, sectionCount, 1, iterations, SecondsSince(start));
+        });
+    }
+
+    void BenchThreads(long long iterations, int threadCount)
+    {
+        std::atomic<bool> go(false);
+        std::atomic<int> ready(0);
+        std::vector<std::thread> threads;
+        std::vector<std::chrono::steady_clock::time_point> finished(threadCount);
+        for (int t = 0; t < threadCount; ++t) {
+            threads.emplace_back([&, t]() {
+                Profiler::GetInstance()->EnterSection("Bench Thread Warmup"); // Registers this thread's buffer up front
+                Profiler::GetInstance()->ExitSection("Bench Thread Warmup");
+                ready.fetch_add(1);
+                while (!go.load(std::memory_order_acquire)) {
+                    std::this_thread::yield();
+                }
+                for (long long i = 0; i < iterations; ++i) {
+                    PROFILER_ENTER("Bench Threaded");
+                    sink = sink + 1;
+                    PROFILER_EXIT("Bench Threaded");
+                }
+                finished[t] = std::chrono::steady_clock::now(); // Before the thread's buffer is retired on exit
+            });
+        }
+        while (ready.load() != threadCount) {
+            std::this_thread::yield();
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        go.store(true, std::memory_order_release);
+        std::chrono::steady_clock::time_point stop = start;
+        for (int t = 0; t < threadCount; ++t) {
+            threads[t].join();
+            stop = finished[t] > stop ? finished[t] : stop;
+        }
+        Report("PROFILER_ENTER/EXIT threaded", 1, 1, threadCount, iterations, std::chrono::duration<double>(stop - start).count());
+    }
+
+    void WriteJSON(const char* fileName, long long iterations)
+    {
+        FILE* file = fopen(fileName, "w");
+        if (!file) {
+            fprintf(stderr, "Error: Unable to open file %s\n", fileName);
+            return;
+        }
+        Profiler* profiler = Profiler::GetInstance();
+        fprintf(file, "{\n  \"clockSource\": \"%s\",\n  \"iterations\": %lld,\n", GetClockSourceName(), iterations);
+        fprintf(file, "  \"calibratedPairTimeNs\": %.3f,\n  \"calibratedEmptySectionTimeNs\": %.3f,\n",
+                1e9 * profiler->GetEnterExitOverheadSeconds(), 1e9 * profiler->GetEmptySectionOverheadSeconds());
+        fprintf(file, "  \"hardwareThreads\": %u,\n  \"benchmarks\": [\n", std::thread::hardware_concurrency());
+        for (size_t i = 0; i < results.size(); ++i) {
+            BenchResult const& r = results[i];
+            fprintf(file, "    {\"api\": \"%s\", \"depth\": %d, \"sections\": %d, \"threads\": %d, \"iterations\": %lld, "
+                          "\"nsPerPair\": %.3f, \"pairsPerSecond\": %.1f}%s\n",
+                    r.api.c_str(), r.depth, r.sections, r.threads, r.iterations, r.nsPerPair, r.pairsPerSecond,
+                    i + 1 < results.size() ? "," : "");
+        }
+        fprintf(file, "  ]\n}\n");
+        fclose(file);
+        printf("Benchmark results written to %s\n", fileName);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    long long iterations = 1000000;
+    const char* jsonFile = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+            iterations = atoll(argv[++i]);
+        } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            jsonFile = argv[++i];
+        } else {
+            fprintf(stderr, "Usage: %s [--iterations N] [--json results.json]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    Profiler* profiler = Profiler::GetInstance();
+    printf("Clock source: %s, calibrated pair cost %.1fns\n", GetClockSourceName(), 1e9 * profiler->GetEnterExitOverheadSeconds());
+
+    std::vector<int> enclosing;
+    for (int level = 0; level < 64; ++level) {
+        enclosing.push_back(Profiler::RegisterSection(("Bench Depth " + std::to_string(level)).c_str(), __FILE__, __FUNCTION__, __LINE__));
+    }
+
+    BenchBaseline(iterations);
+
+    const int depths[] = { 1, 4, 16, 64 };
+    for (int depth : depths) {
+        BenchMacros(iterations, depth, enclosing);
+        BenchStatsPolicy(iterations, depth, enclosing);
+        BenchScopeMacro(iterations, depth, enclosing);
+        BenchScopeObject(iterations, depth, enclosing);
+        BenchDirectByName(iterations, depth, enclosing);
+    }
+
+    // Distinct sections under one parent are siblings in the call tree, so these rows also time the
+    // child lookup on enter; at depth 4 the siblings hang off an enclosing section rather than the root
+    const int sectionCounts[] = { 1, 16, 256, 4096 };
+    for (int sectionCount : sectionCounts) {
+        std::vector<int> sectionIds;
+        for (int i = 0; i < sectionCount; ++i) {
+            sectionIds.push_back(Profiler::RegisterSection(("Bench Section " + std::to_string(i)).c_str(), __FILE__, __FUNCTION__, __LINE__));
+        }
+        BenchDirectById(iterations, 1, sectionIds, enclosing);
+        if (sectionCount == 4096) {
+            BenchDirectById(iterations, 4, sectionIds, enclosing);
+        }
+    }
+
+    const int threadCounts[] = { 1, 2, 4, 8, 16, 32 };
+    for (int threadCount : threadCounts) {
+        BenchThreads(iterations, threadCount);
+    }
+
+    if (jsonFile) {
+        WriteJSON(jsonFile, iterations);
+    }
+
+    delete profiler;
+    return 0;
+}
@@ -0,0 +1,60 @@
+#include "histogram.hpp"
+
+#include <cmath>
+
+void LatencyHistogram::Merge(LatencyHistogram const& other)
+{
+    for (int bucket = 0; bucket < BUCKET_COUNT; ++bucket)
+    {
+        counts[bucket] += other.counts[bucket];
+    }
+    totalCount += other.totalCount;
+}
+
+uint64_t LatencyHistogram::BucketLowerBound(int bucket)
+{
+    if (bucket < SUB_BUCKETS)
+    {
+        return (uint64_t)bucket;
+    }
+    int shift = bucket / SUB_BUCKETS - 1;
+    uint64_t subBucket = (uint64_t)(bucket % SUB_BUCKETS);
+    return ((uint64_t)SUB_BUCKETS + subBucket) << shift;
+}
+
+uint64_t LatencyHistogram::BucketUpperBound(int bucket)
+{
+    if (bucket < SUB_BUCKETS)
+    {
+        return (uint64_t)bucket;
+    }
+    int shift = bucket / SUB_BUCKETS - 1;
+    return BucketLowerBound(bucket) + ((uint64_t(1) << shift) - 1);
+}
+
+uint64_t LatencyHistogram::Percentile(double fraction) const
+{
+    if (totalCount == 0)
+    {
+        return 0;
+    }
+
+    // Rank of the target recording, 1-based, so p100 is the last one
+    uint64_t rank = (uint64_t)std::ceil(fraction * double(totalCount));
+    if (rank < 1)
+    {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    for (int bucket = 0; bucket < BUCKET_COUNT; ++bucket)
+    {
+        seen += counts[bucket];
+        if (seen >= rank)
+        {
+            uint64_t lower = BucketLowerBound(bucket);
+            return lower + (BucketUpperBound(bucket) - lower) / 2;
+        }
+    }
+    return BucketUpperBound(BUCKET_COUNT - 1);
+}
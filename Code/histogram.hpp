@@ -0,0 +1,53 @@
+// include/histogram.hpp
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+// Log-linear (HDR-style) histogram of tick counts. Each power of two is split into
+// SUB_BUCKETS linear buckets, so any recorded value lands in a bucket at most 1/16 of its
+// size wide. Recording is a count-leading-zeros and an increment; merging is an add per bucket.
+class LatencyHistogram {
+    public:
+        static const int SUB_BUCKET_BITS = 4;
+        static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+        static const int BUCKET_COUNT = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+        LatencyHistogram() { Clear(); }
+
+        void Clear()
+        {
+            memset(counts, 0, sizeof(counts));
+            totalCount = 0;
+        }
+
+        void Record(uint64_t ticks)
+        {
+            counts[BucketIndex(ticks)]++;
+            totalCount++;
+        }
+
+        void Merge(LatencyHistogram const& other);
+
+        // Value below which the given fraction (0..1) of recordings fall, as the midpoint of its bucket
+        uint64_t Percentile(double fraction) const;
+
+        uint64_t GetTotalCount() const { return totalCount; }
+        uint64_t GetCount(int bucket) const { return counts[bucket]; }
+
+        static int BucketIndex(uint64_t ticks)
+        {
+            if (ticks < (uint64_t)SUB_BUCKETS)
+            {
+                return (int)ticks;
+            }
+            int shift = (63 - __builtin_clzll(ticks)) - SUB_BUCKET_BITS;
+            return (shift + 1) * SUB_BUCKETS + (int)((ticks >> shift) & (SUB_BUCKETS - 1));
+        }
+        static uint64_t BucketLowerBound(int bucket);
+        static uint64_t BucketUpperBound(int bucket);
+
+    private:
+        uint64_t counts[BUCKET_COUNT];
+        uint64_t totalCount;
+};
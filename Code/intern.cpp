@@ -0,0 +1,192 @@
+#include "intern.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+namespace {
+    const size_t ARENA_BLOCK_SIZE = 64 * 1024;
+    const size_t INITIAL_TABLE_CAPACITY = 256;
+}
+
+InternTable::InternTable() : count(0), block(nullptr), blockUsed(0), blockSize(0), retiredBlocks(nullptr)
+{
+    for (int segment = 0; segment < MAX_SEGMENTS; ++segment) {
+        segments[segment].store(nullptr, std::memory_order_relaxed);
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    table.store(NewTable(INITIAL_TABLE_CAPACITY), std::memory_order_release);
+}
+
+// Arena memory comes from malloc, not operator new, so interning never shows up in allocation tracking
+InternTable::~InternTable()
+{
+    while (retiredBlocks) {
+        void* next = *static_cast<void**>(retiredBlocks);
+        free(retiredBlocks);
+        retiredBlocks = next;
+    }
+}
+
+// FNV-1a
+uint64_t InternTable::Hash(char const* text, size_t length)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= (unsigned char)text[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+void* InternTable::Allocate(size_t bytes)
+{
+    bytes = (bytes + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+    if (!block || blockUsed + bytes > blockSize) {
+        // Every block starts with a link to the previous one, for the destructor
+        size_t header = alignof(std::max_align_t);
+        blockSize = (bytes + header > ARENA_BLOCK_SIZE) ? bytes + header : ARENA_BLOCK_SIZE;
+        block = static_cast<char*>(malloc(blockSize));
+        if (!block) {
+            fprintf(stderr, "Error: Out of memory interning strings\n");
+            abort();
+        }
+        *reinterpret_cast<void**>(block) = retiredBlocks;
+        retiredBlocks = block;
+        blockUsed = header;
+    }
+    void* memory = block + blockUsed;
+    blockUsed += bytes;
+    return memory;
+}
+
+InternTable::Table* InternTable::NewTable(size_t capacity)
+{
+    Table* newTable = new (Allocate(sizeof(Table))) Table();
+    newTable->mask = capacity - 1;
+    newTable->slots = static_cast<std::atomic<Entry*>*>(Allocate(capacity * sizeof(std::atomic<Entry*>)));
+    for (size_t slot = 0; slot < capacity; ++slot) {
+        new (&newTable->slots[slot]) std::atomic<Entry*>(nullptr);
+    }
+    return newTable;
+}
+
+void InternTable::Insert(Table* target, Entry* entry)
+{
+    size_t slot = entry->hash & target->mask;
+    while (target->slots[slot].load(std::memory_order_relaxed)) {
+        slot = (slot + 1) & target->mask;
+    }
+    target->slots[slot].store(entry, std::memory_order_release);
+}
+
+int InternTable::Find(char const* text, size_t length) const
+{
+    uint64_t hash = Hash(text, length);
+    Table const* current = table.load(std::memory_order_acquire);
+    for (size_t slot = hash & current->mask; ; slot = (slot + 1) & current->mask) {
+        Entry const* entry = current->slots[slot].load(std::memory_order_acquire);
+        if (!entry) {
+            return -1;
+        }
+        if (entry->hash == hash && entry->length == length && memcmp(entry->Text(), text, length) == 0) {
+            return entry->id;
+        }
+    }
+}
+
+int InternTable::Intern(char const* text, size_t length)
+{
+    int id = Find(text, length);
+    if (id >= 0) {
+        return id;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    id = Find(text, length); // Another thread may have added it, or grown the table, meanwhile
+    if (id >= 0) {
+        return id;
+    }
+
+    id = count.load(std::memory_order_relaxed);
+    int segment = id >> SEGMENT_BITS;
+    if (segment >= MAX_SEGMENTS) {
+        // Millions of distinct names means names built from unbounded data
+        fprintf(stderr, "Error: More than %d interned strings\n", MAX_SEGMENTS << SEGMENT_BITS);
+        abort();
+    }
+
+    Entry* entry = new (Allocate(sizeof(Entry) + length + 1)) Entry();
+    entry->hash = Hash(text, length);
+    entry->length = (uint32_t)length;
+    entry->id = id;
+    entry->value.store(-1, std::memory_order_relaxed);
+    memcpy(const_cast<char*>(entry->Text()), text, length);
+    const_cast<char*>(entry->Text())[length] = '\0';
+
+    // Index by id first, so anyone who finds the entry can also resolve its id
+    std::atomic<Entry*>* ids = segments[segment].load(std::memory_order_relaxed);
+    if (!ids) {
+        size_t segmentSize = size_t(1) << SEGMENT_BITS;
+        ids = static_cast<std::atomic<Entry*>*>(Allocate(segmentSize * sizeof(std::atomic<Entry*>)));
+        for (size_t i = 0; i < segmentSize; ++i) {
+            new (&ids[i]) std::atomic<Entry*>(nullptr);
+        }
+        segments[segment].store(ids, std::memory_order_release);
+    }
+    ids[id & ((1 << SEGMENT_BITS) - 1)].store(entry, std::memory_order_release);
+
+    // Keep the table at most half full. Readers still probing the old one see every earlier entry
+    // there; the old table is left in the arena rather than freed under them.
+    Table* current = table.load(std::memory_order_relaxed);
+    if (size_t(id + 1) * 2 > current->mask + 1) {
+        Table* grown = NewTable((current->mask + 1) * 2);
+        for (int existing = 0; existing < id; ++existing) {
+            Insert(grown, GetEntry(existing));
+        }
+        Insert(grown, entry);
+        table.store(grown, std::memory_order_release);
+    } else {
+        Insert(current, entry);
+    }
+    count.store(id + 1, std::memory_order_release);
+    return id;
+}
+
+int InternTable::Intern(char const* text)
+{
+    return Intern(text, strlen(text));
+}
+
+InternTable::Entry* InternTable::GetEntry(int id) const
+{
+    std::atomic<Entry*>* ids = segments[id >> SEGMENT_BITS].load(std::memory_order_acquire);
+    return ids[id & ((1 << SEGMENT_BITS) - 1)].load(std::memory_order_acquire);
+}
+
+char const* InternTable::GetString(int id) const
+{
+    return GetEntry(id)->Text();
+}
+
+size_t InternTable::GetLength(int id) const
+{
+    return GetEntry(id)->length;
+}
+
+int InternTable::GetValue(int id) const
+{
+    return GetEntry(id)->value.load(std::memory_order_acquire);
+}
+
+void InternTable::SetValue(int id, int value)
+{
+    GetEntry(id)->value.store(value, std::memory_order_release);
+}
+
+InternTable& GetInternedStrings()
+{
+    static InternTable strings;
+    return strings;
+}
@@ -0,0 +1,69 @@
+// include/intern.hpp
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+// Maps byte strings to dense, stable ids for the life of the process. Section names and tags go
+// through here, so a name built at runtime is matched by content, not by pointer, and may be freed
+// as soon as the call that passed it returns.
+//
+// Reads never lock or allocate: the hash table and the id index are published with release stores
+// and never freed, and entries are immutable once published. Adding a string takes a mutex and
+// copies it into an append-only arena. Memory is not returned until exit, so intern a bounded set
+// (request types, shard names), not unbounded user data.
+class InternTable {
+    public:
+        InternTable();
+        ~InternTable();
+
+        int Intern(char const* text, size_t length);       // Finds or adds; locks only when adding
+        int Intern(char const* text);
+        int Find(char const* text, size_t length) const;    // -1 when absent (or added concurrently)
+
+        char const* GetString(int id) const;                // Zero-terminated copy, valid until exit
+        size_t GetLength(int id) const;
+        int GetCount() const { return count.load(std::memory_order_acquire); }
+
+        // One int per string for the owner's use, -1 until set; read without locking
+        int GetValue(int id) const;
+        void SetValue(int id, int value);
+
+    private:
+        struct Entry {
+            uint64_t hash;
+            uint32_t length;
+            int id;
+            std::atomic<int> value;
+            char const* Text() const { return reinterpret_cast<char const*>(this + 1); }
+        };
+
+        // Open addressing with linear probing; replaced by one twice the size at half full
+        struct Table {
+            size_t mask;
+            std::atomic<Entry*>* slots;
+        };
+
+        static const int SEGMENT_BITS = 10;                 // Ids per segment of the id index
+        static const int MAX_SEGMENTS = 4096;               // So at most 4M strings
+
+        static uint64_t Hash(char const* text, size_t length);
+        void* Allocate(size_t bytes);                       // From the arena; call with mutex held
+        Table* NewTable(size_t capacity);
+        void Insert(Table* table, Entry* entry);
+        Entry* GetEntry(int id) const;
+
+        std::atomic<Table*> table;
+        std::atomic<std::atomic<Entry*>*> segments[MAX_SEGMENTS];
+        std::atomic<int> count;
+        std::mutex mutex;                                   // Serializes adds; readers never take it
+        char* block;                                        // Arena block being filled
+        size_t blockUsed;
+        size_t blockSize;
+        void* retiredBlocks;                                // Linked through their first word, freed at exit
+};
+
+// The process-wide table; like the section registry it outlives any Profiler instance
+InternTable& GetInternedStrings();
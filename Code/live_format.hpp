@@ -0,0 +1,53 @@
+// include/live_format.hpp
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Layout of the shared-memory stats table published by LiveStatsPublisher. Plain structs only, so
+// an external reader can map the region without linking the profiler.
+//
+//   LiveStatsHeader
+//   LiveSectionRecord[sectionCapacity]    at headerSize, recordSize bytes apart
+//
+// The whole table is guarded by one seqlock: the publisher makes sequence odd, rewrites the
+// records and makes it even again. A reader copies the table, then retries if sequence was odd or
+// changed while it was copying. Readers never write to the region.
+
+static const char LIVE_STATS_MAGIC[8] = { 'P', 'R', 'O', 'F', 'L', 'I', 'V', '1' };
+static const uint32_t LIVE_STATS_VERSION = 1;
+static const uint32_t LIVE_SECTION_NAME_SIZE = 64;
+static const char LIVE_STATS_NAME_PREFIX[] = "/profiler_live."; // Default region name is this plus the pid
+
+struct LiveStatsHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;              // sizeof(LiveStatsHeader), for forward compatibility
+    uint32_t recordSize;              // sizeof(LiveSectionRecord)
+    uint32_t sectionCapacity;         // Records the region has room for
+    std::atomic<uint64_t> sequence;   // Seqlock, odd while the publisher is writing
+    uint64_t publishCount;            // Bumped on every publish; a reader can tell a stalled process
+    double publishTime;               // Seconds since the profiler's clock started, at the last publish
+    double intervalSeconds;           // How often the publisher refreshes the table
+    uint32_t sectionCount;            // Records in use
+    uint32_t processId;
+};
+
+// Cumulative stats for one section, times in seconds with sampled totals extrapolated
+struct LiveSectionRecord {
+    char sectionName[LIVE_SECTION_NAME_SIZE]; // Truncated if longer, always NUL-terminated
+    int32_t sectionId;
+    uint32_t reserved;
+    uint64_t count;
+    uint64_t sampledCount;
+    double totalTime;
+    double minTime;
+    double maxTime;
+    double avgTime;
+    double p50Time;
+    double p90Time;
+    double p99Time;
+    double p999Time;
+};
+
+static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t), "The seqlock must be a plain 64-bit word in shared memory");
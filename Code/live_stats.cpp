@@ -0,0 +1,243 @@
+#include "live_stats.hpp"
+
+#include "profiler.hpp"
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <new>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+LiveStatsPublisher::LiveStatsPublisher()
+    : header(nullptr), records(nullptr), mappingSize(0), intervalSeconds(0.0), stopping(false)
+{
+}
+
+LiveStatsPublisher::~LiveStatsPublisher()
+{
+    Close();
+}
+
+bool LiveStatsPublisher::Open(const char* regionName, size_t sectionCapacity, double interval, std::function<void()> refreshCallback)
+{
+    Close();
+
+    if (interval <= 0.0 || sectionCapacity == 0) {
+        std::cerr << "Error: Live stats need a positive interval and section capacity." << std::endl;
+        return false;
+    }
+
+    // O_EXCL: a region of this name belongs to another process, or is left over from one that
+    // crashed, and is never ours to truncate or unlink
+    int fd = shm_open(regionName, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0 && errno == EEXIST) {
+        std::cerr << "Error: Shared memory " << regionName << " already exists; pick another name or remove it." << std::endl;
+        return false;
+    }
+    if (fd < 0) {
+        std::cerr << "Error: Unable to create shared memory " << regionName << std::endl;
+        return false;
+    }
+    size_t size = sizeof(LiveStatsHeader) + sectionCapacity * sizeof(LiveSectionRecord);
+    if (ftruncate(fd, (off_t)size) != 0) {
+        std::cerr << "Error: Unable to size shared memory " << regionName << std::endl;
+        close(fd);
+        shm_unlink(regionName);
+        return false;
+    }
+    void* mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd); // The mapping keeps the region alive
+    if (mapped == MAP_FAILED) {
+        std::cerr << "Error: Unable to map shared memory " << regionName << std::endl;
+        shm_unlink(regionName);
+        return false;
+    }
+
+    name = regionName;
+    mappingSize = size;
+    header = new (mapped) LiveStatsHeader(); // Fresh pages are zeroed; this just starts the header's lifetime
+    records = reinterpret_cast<LiveSectionRecord*>(static_cast<unsigned char*>(mapped) + sizeof(LiveStatsHeader));
+    intervalSeconds = interval;
+    refresh = refreshCallback;
+
+    header->version = LIVE_STATS_VERSION;
+    header->headerSize = sizeof(LiveStatsHeader);
+    header->recordSize = sizeof(LiveSectionRecord);
+    header->sectionCapacity = (uint32_t)sectionCapacity;
+    header->sequence.store(0, std::memory_order_relaxed);
+    header->intervalSeconds = interval;
+    header->processId = (uint32_t)getpid();
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(header->magic, LIVE_STATS_MAGIC, sizeof(header->magic)); // Last, so readers never see a half-built header
+
+    stopping = false;
+    refreshThread = std::thread(&LiveStatsPublisher::RefreshLoop, this);
+    return true;
+}
+
+std::string LiveStatsPublisher::DefaultName()
+{
+    return LIVE_STATS_NAME_PREFIX + std::to_string(getpid());
+}
+
+void LiveStatsPublisher::Close()
+{
+    if (refreshThread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(refreshMutex);
+            stopping = true;
+        }
+        refreshWake.notify_one();
+        refreshThread.join();
+    }
+    if (header) {
+        munmap(header, mappingSize);
+        shm_unlink(name.c_str());
+        header = nullptr;
+        records = nullptr;
+        mappingSize = 0;
+    }
+}
+
+// Called only from the refresh thread (or before it starts), so there is a single writer
+void LiveStatsPublisher::Publish(std::vector<ProfilerStats> const& stats, double publishTime)
+{
+    if (!header) {
+        return;
+    }
+
+    uint64_t sequence = header->sequence.load(std::memory_order_relaxed);
+    header->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release); // Odd sequence is visible before any record changes
+
+    uint32_t count = 0;
+    for (ProfilerStats const& stat: stats) {
+        if (stat.count == 0) {
+            continue;
+        }
+        if (count == header->sectionCapacity) {
+            break; // Region is full; later sections are left out
+        }
+        LiveSectionRecord& record = records[count++];
+        strncpy(record.sectionName, stat.sectionName ? stat.sectionName : "", LIVE_SECTION_NAME_SIZE - 1);
+        record.sectionName[LIVE_SECTION_NAME_SIZE - 1] = '\0';
+        record.sectionId = stat.sectionId;
+        record.reserved = 0;
+        record.count = (uint64_t)stat.count;
+        record.sampledCount = (uint64_t)stat.sampledCount;
+        record.totalTime = stat.totalTime;
+        record.minTime = stat.minTime;
+        record.maxTime = stat.maxTime;
+        record.avgTime = stat.avgTime;
+        record.p50Time = stat.p50Time;
+        record.p90Time = stat.p90Time;
+        record.p99Time = stat.p99Time;
+        record.p999Time = stat.p999Time;
+    }
+    header->sectionCount = count;
+    header->publishCount++;
+    header->publishTime = publishTime;
+
+    header->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+void LiveStatsPublisher::RefreshLoop()
+{
+    std::chrono::duration<double> interval(intervalSeconds);
+    std::unique_lock<std::mutex> lock(refreshMutex);
+    do {
+        lock.unlock();
+        refresh();
+        lock.lock();
+    } while (!refreshWake.wait_for(lock, interval, [this]() { return stopping; }));
+}
+
+LiveStatsReader::LiveStatsReader()
+    : header(nullptr), records(nullptr), mappingSize(0)
+{
+}
+
+LiveStatsReader::~LiveStatsReader()
+{
+    Close();
+}
+
+bool LiveStatsReader::Open(const char* name)
+{
+    Close();
+
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        std::cerr << "Error: No live stats published as " << name << std::endl;
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(LiveStatsHeader)) {
+        std::cerr << "Error: Shared memory " << name << " is too small for live stats." << std::endl;
+        close(fd);
+        return false;
+    }
+    void* mapped = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        std::cerr << "Error: Unable to map shared memory " << name << std::endl;
+        return false;
+    }
+    mappingSize = (size_t)info.st_size;
+    header = static_cast<LiveStatsHeader const*>(mapped);
+
+    if (memcmp(header->magic, LIVE_STATS_MAGIC, sizeof(header->magic)) != 0 || header->version != LIVE_STATS_VERSION
+        || header->headerSize + (size_t)header->sectionCapacity * header->recordSize > mappingSize) {
+        std::cerr << "Error: Shared memory " << name << " does not hold live stats this reader understands." << std::endl;
+        Close();
+        return false;
+    }
+    records = reinterpret_cast<LiveSectionRecord const*>(static_cast<unsigned char const*>(mapped) + header->headerSize);
+    return true;
+}
+
+void LiveStatsReader::Close()
+{
+    if (header) {
+        munmap(const_cast<LiveStatsHeader*>(header), mappingSize);
+        header = nullptr;
+        records = nullptr;
+        mappingSize = 0;
+    }
+}
+
+bool LiveStatsReader::Read(LiveStatsCopy& copy, int maxAttempts)
+{
+    if (!header) {
+        return false;
+    }
+    for (int attempt = 0; attempt < maxAttempts; ++attempt) {
+        uint64_t before = header->sequence.load(std::memory_order_acquire);
+        if (before & 1) {
+            std::this_thread::yield(); // Publisher is mid-write
+            continue;
+        }
+
+        uint32_t count = header->sectionCount;
+        if (count > header->sectionCapacity) {
+            continue; // Torn read of the count itself; the sequence check below would reject it anyway
+        }
+        copy.publishCount = header->publishCount;
+        copy.publishTime = header->publishTime;
+        copy.intervalSeconds = header->intervalSeconds;
+        copy.processId = header->processId;
+        copy.sections.resize(count);
+        if (count > 0) {
+            memcpy(copy.sections.data(), records, count * sizeof(LiveSectionRecord));
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire); // The copy completes before the re-check
+        if (header->sequence.load(std::memory_order_relaxed) == before) {
+            return true;
+        }
+    }
+    return false;
+}
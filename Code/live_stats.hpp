@@ -0,0 +1,71 @@
+// include/live_stats.hpp
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "live_format.hpp"
+
+class ProfilerStats;
+
+// Owns a POSIX shared-memory region holding the live stats table (see live_format.hpp) and the
+// thread that refreshes it. The refresh callback gathers stats and hands them to Publish.
+class LiveStatsPublisher {
+    public:
+        LiveStatsPublisher();
+        ~LiveStatsPublisher();
+
+        // Creates the region; fails rather than take over one that already exists
+        bool Open(const char* name, size_t sectionCapacity, double intervalSeconds, std::function<void()> refresh);
+        void Close();                  // Stops the thread and unlinks the region, which Open created
+        static std::string DefaultName(); // LIVE_STATS_NAME_PREFIX and this process's pid
+        bool IsOpen() const { return header != nullptr; }
+
+        void Publish(std::vector<ProfilerStats> const& stats, double publishTime);
+
+    private:
+        void RefreshLoop();
+
+        std::string name;
+        LiveStatsHeader* header;       // Start of the mapping
+        LiveSectionRecord* records;
+        size_t mappingSize;
+        double intervalSeconds;
+        std::function<void()> refresh;
+
+        std::thread refreshThread;
+        std::mutex refreshMutex;       // Only used by the thread's sleep and Close
+        std::condition_variable refreshWake;
+        bool stopping;
+};
+
+// One consistent copy of the table, as returned by LiveStatsReader::Read
+struct LiveStatsCopy {
+    uint64_t publishCount;
+    double publishTime;
+    double intervalSeconds;
+    uint32_t processId;
+    std::vector<LiveSectionRecord> sections;
+};
+
+// Maps a published table read-only and takes consistent copies of it
+class LiveStatsReader {
+    public:
+        LiveStatsReader();
+        ~LiveStatsReader();
+
+        bool Open(const char* name);
+        void Close();
+
+        // Copies the table as of one complete publish; false if the publisher kept it busy
+        bool Read(LiveStatsCopy& copy, int maxAttempts = 1000);
+
+    private:
+        LiveStatsHeader const* header;
+        LiveSectionRecord const* records;
+        size_t mappingSize;
+};
@@ -1,8 +1,19 @@
 #include "profiler.hpp"
+#include "trace_export.hpp"
 #include <iostream> 
 #include <cstdlib>
 #include <cstdio>
 #include <cmath>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 Profiler* profiler = nullptr; 
 constexpr float DEGREES_TO_RADIANS = (3.1415926535897932384626433f / 180.0f);
@@ -21,6 +32,8 @@ void Test1()
     {
         randomYawDegreeTable[i] = 360.0f * float(rand()) / float(RAND_MAX); // Fill the array with random angles
     }
+    profiler->AddItems(TRIG_TEST_NUM_ENTRIES); // Report angles/s and GB/s next to the time
+    profiler->AddBytes(sizeof(randomYawDegreeTable));
     // Exit the angle generation section
     profiler->ExitSection("Random Angle Generation", __LINE__, __FILE__, __FUNCTION__);
     
@@ -67,6 +80,8 @@ void Test2()
     {
         randomYawDegreeTable[i] = 360.0f * float(rand()) / float(RAND_MAX);
     }
+    PROFILER_ADD_ITEMS(TRIG_TEST_NUM_ENTRIES);
+    PROFILER_ADD_BYTES(sizeof(randomYawDegreeTable));
     // Exit the angle generation section
     PROFILER_EXIT("Random Angle Generation");
 
@@ -115,6 +130,8 @@ void Test2()
     {
         randomYawDegreeTable[i] = 360.0f * float(rand()) / float(RAND_MAX);
     }
+    PROFILER_ADD_ITEMS(TRIG_TEST_NUM_ENTRIES);
+    PROFILER_ADD_BYTES(sizeof(randomYawDegreeTable));
     // Exit the angle generation section
     PROFILER_EXIT("Random Angle Generation");
 
@@ -162,21 +179,426 @@ void RunInterleavedTest() {
     // Finalize Task A
     profiler->ExitSection("Task A");
 }
+void RunMultithreadedTest() {
+    // Each worker records into its own buffer, so nested sections on different threads don't interfere
+    constexpr int NUM_WORKERS = 4;
+    // The inner section is too hot to time every call; time 1 in 10 and extrapolate
+    Profiler::SetSamplingPolicy("Worker Cos Compute", ProfilerSamplingPolicy::OneIn(10));
+    std::mutex sharedLock;
+    std::vector<std::thread> workers;
+    for (int t = 0; t < NUM_WORKERS; ++t) {
+        workers.emplace_back([&sharedLock]() {
+            ProfilerScopeObject workerScope("Worker Thread");
+            float sum = 0.f;
+            for (int i = 0; i < 10000; ++i) {
+                PROFILER_ENTER("Worker Cos Compute");
+                sum += cosf(float(i) * DEGREES_TO_RADIANS);
+                PROFILER_EXIT("Worker Cos Compute");
+            }
+            {
+                // Waiting for the lock and sleeping under it are wall time without CPU time
+                ProfilerScopeObject lockScope("Worker Shared Lock");
+                std::lock_guard<std::mutex> lock(sharedLock);
+                std::this_thread::sleep_for(std::chrono::milliseconds(2)); // Stands in for I/O under the lock
+            }
+            if (sum == 12345.f) {
+                std::cout << sum << std::endl; // Keep the loop from being optimized away
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+void RunTaggedRequestTest() {
+    // One "Handle Request" section split by request type with tags, instead of one section per type
+    static char const* const REQUEST_TYPES[] = { "GET", "PUT", "DELETE" };
+    constexpr int NUM_REQUESTS = 300;
+    constexpr int NUM_SHARDS = 4;
+    float sum = 0.f;
+    for (int request = 0; request < NUM_REQUESTS; ++request) {
+        char const* requestType = REQUEST_TYPES[request % 3];
+        ProfilerScopeObject requestScope("Handle Request");
+        PROFILER_TAG("request", requestType);
+
+        // Section names built at runtime are interned by content, so the string can go right away
+        std::string shardName = "Shard " + std::to_string(request % NUM_SHARDS);
+        profiler->EnterSection(shardName.c_str());
+        int work = (request % 3 + 1) * 200; // Writes cost more than reads
+        for (int i = 0; i < work; ++i) {
+            sum += sinf(float(i + request) * DEGREES_TO_RADIANS);
+        }
+        profiler->ExitSection(shardName.c_str());
+    }
+    if (sum == 12345.f) {
+        std::cout << sum << std::endl; // Keep the loop from being optimized away
+    }
+}
+void RunAsyncTest() {
+    // Tasks start on workers and finish on whichever thread picks up the result, so they use span
+    // tokens instead of the per-thread section stack
+    constexpr int NUM_TASKS = 4;
+    ProfilerSpan batch = profiler->BeginSpan("Async Batch");
+    std::vector<ProfilerSpan> tasks(NUM_TASKS);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < NUM_TASKS; ++t) {
+        workers.emplace_back([&tasks, &batch, t]() {
+            tasks[t] = profiler->BeginSpan("Async Task", &batch);
+            float sum = 0.f;
+            for (int i = 0; i < 10000; ++i) {
+                sum += sinf(float(i + t) * DEGREES_TO_RADIANS);
+            }
+            if (sum == 12345.f) {
+                std::cout << sum << std::endl; // Keep the loop from being optimized away
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    // The continuation ends every task and the batch on a different thread than began them
+    std::thread continuation([&tasks, &batch]() {
+        for (ProfilerSpan& task : tasks) {
+            profiler->EndSpan(task);
+        }
+        profiler->EndSpan(batch);
+    });
+    continuation.join();
+}
+// Trig kernel comparison: the same sin/cos workload as Test1 written five ways. Each kernel runs in
+// its own section and is also timed with steady_clock, so the profiler's speedups can be checked
+// against an independent measurement. Chunks get their own section to show how the profiler
+// resolves calls of a few microseconds.
+constexpr int TRIG_KERNEL_NUM_ENTRIES = 1 << 20;
+constexpr int TRIG_KERNEL_MT_NUM_ENTRIES = TRIG_KERNEL_NUM_ENTRIES * 4; // The multithreaded kernel gets a much larger table
+constexpr int TRIG_KERNEL_CHUNK = 4096;                                 // Angles per chunk section
+constexpr int TRIG_KERNEL_LUT_SIZE = 4096;                              // Lookup table entries per full turn
+
+typedef void (*SinCosKernel)(float const* degrees, float* sines, float* cosines, int count);
+
+void SinCosScalar(float const* degrees, float* sines, float* cosines, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        sines[i] = sinf(degrees[i] * DEGREES_TO_RADIANS);
+        cosines[i] = cosf(degrees[i] * DEGREES_TO_RADIANS);
+    }
+}
+
+float sinLookupTable[TRIG_KERNEL_LUT_SIZE + 1]; // One extra entry so interpolation never wraps
+
+void InitSinLookupTable()
+{
+    for (int i = 0; i <= TRIG_KERNEL_LUT_SIZE; i++)
+    {
+        sinLookupTable[i] = float(sin(2.0 * 3.14159265358979323846 * double(i) / double(TRIG_KERNEL_LUT_SIZE)));
+    }
+}
+
+// Linear interpolation between table entries; cosine reads the same table a quarter turn ahead.
+// Good to about 1e-6 for angles in [0, 360].
+void SinCosLookup(float const* degrees, float* sines, float* cosines, int count)
+{
+    constexpr float ENTRIES_PER_DEGREE = float(TRIG_KERNEL_LUT_SIZE) / 360.0f;
+    constexpr int QUARTER_TURN = TRIG_KERNEL_LUT_SIZE / 4;
+    for (int i = 0; i < count; i++)
+    {
+        float position = degrees[i] * ENTRIES_PER_DEGREE;
+        int index = int(position);
+        float fraction = position - float(index);
+        int sinIndex = index & (TRIG_KERNEL_LUT_SIZE - 1);
+        int cosIndex = (index + QUARTER_TURN) & (TRIG_KERNEL_LUT_SIZE - 1);
+        sines[i] = sinLookupTable[sinIndex] + fraction * (sinLookupTable[sinIndex + 1] - sinLookupTable[sinIndex]);
+        cosines[i] = sinLookupTable[cosIndex] + fraction * (sinLookupTable[cosIndex + 1] - sinLookupTable[cosIndex]);
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// Cephes sincosf, several lanes at a time: reduce to an octant of [0, pi/4] with a three-part pi/4,
+// evaluate both minimax polynomials and pick per lane. Good to a few ulp for |x| below 8192.
+namespace SinCosConstants {
+    constexpr float FOUR_OVER_PI = 1.27323954473516f;
+    constexpr float MINUS_DP1 = -0.78515625f;
+    constexpr float MINUS_DP2 = -2.4187564849853515625e-4f;
+    constexpr float MINUS_DP3 = -3.77489497744594108e-8f;
+    constexpr float SIN_P0 = -1.9515295891e-4f;
+    constexpr float SIN_P1 = 8.3321608736e-3f;
+    constexpr float SIN_P2 = -1.6666654611e-1f;
+    constexpr float COS_P0 = 2.443315711809948e-5f;
+    constexpr float COS_P1 = -1.388731625493765e-3f;
+    constexpr float COS_P2 = 4.166664568298827e-2f;
+}
+
+void SinCosSSE2(float const* degrees, float* sines, float* cosines, int count)
+{
+    using namespace SinCosConstants;
+    __m128 const signMask = _mm_castsi128_ps(_mm_set1_epi32(int(0x80000000u)));
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 x = _mm_mul_ps(_mm_loadu_ps(degrees + i), _mm_set1_ps(DEGREES_TO_RADIANS));
+        __m128 sinSign = _mm_and_ps(x, signMask);
+        x = _mm_andnot_ps(signMask, x);
+
+        __m128i octant = _mm_cvttps_epi32(_mm_mul_ps(x, _mm_set1_ps(FOUR_OVER_PI)));
+        octant = _mm_and_si128(_mm_add_epi32(octant, _mm_set1_epi32(1)), _mm_set1_epi32(~1));
+        __m128 y = _mm_cvtepi32_ps(octant);
+
+        sinSign = _mm_xor_ps(sinSign, _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(octant, _mm_set1_epi32(4)), 29)));
+        __m128 cosSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_andnot_si128(_mm_sub_epi32(octant, _mm_set1_epi32(2)), _mm_set1_epi32(4)), 29));
+        __m128 sinPolyMask = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(octant, _mm_set1_epi32(2)), _mm_setzero_si128()));
+
+        x = _mm_add_ps(x, _mm_mul_ps(y, _mm_set1_ps(MINUS_DP1)));
+        x = _mm_add_ps(x, _mm_mul_ps(y, _mm_set1_ps(MINUS_DP2)));
+        x = _mm_add_ps(x, _mm_mul_ps(y, _mm_set1_ps(MINUS_DP3)));
+        __m128 z = _mm_mul_ps(x, x);
+
+        __m128 cosPoly = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(COS_P0), z), _mm_set1_ps(COS_P1));
+        cosPoly = _mm_add_ps(_mm_mul_ps(cosPoly, z), _mm_set1_ps(COS_P2));
+        cosPoly = _mm_mul_ps(_mm_mul_ps(cosPoly, z), z);
+        cosPoly = _mm_add_ps(_mm_sub_ps(cosPoly, _mm_mul_ps(z, _mm_set1_ps(0.5f))), _mm_set1_ps(1.0f));
+
+        __m128 sinPoly = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(SIN_P0), z), _mm_set1_ps(SIN_P1));
+        sinPoly = _mm_add_ps(_mm_mul_ps(sinPoly, z), _mm_set1_ps(SIN_P2));
+        sinPoly = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(sinPoly, z), x), x);
+
+        __m128 sinResult = _mm_or_ps(_mm_and_ps(sinPolyMask, sinPoly), _mm_andnot_ps(sinPolyMask, cosPoly));
+        __m128 cosResult = _mm_or_ps(_mm_and_ps(sinPolyMask, cosPoly), _mm_andnot_ps(sinPolyMask, sinPoly));
+        _mm_storeu_ps(sines + i, _mm_xor_ps(sinResult, sinSign));
+        _mm_storeu_ps(cosines + i, _mm_xor_ps(cosResult, cosSign));
+    }
+    SinCosScalar(degrees + i, sines + i, cosines + i, count - i);
+}
+
+__attribute__((target("avx2,fma")))
+void SinCosAVX2(float const* degrees, float* sines, float* cosines, int count)
+{
+    using namespace SinCosConstants;
+    __m256 const signMask = _mm256_castsi256_ps(_mm256_set1_epi32(int(0x80000000u)));
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256 x = _mm256_mul_ps(_mm256_loadu_ps(degrees + i), _mm256_set1_ps(DEGREES_TO_RADIANS));
+        __m256 sinSign = _mm256_and_ps(x, signMask);
+        x = _mm256_andnot_ps(signMask, x);
+
+        __m256i octant = _mm256_cvttps_epi32(_mm256_mul_ps(x, _mm256_set1_ps(FOUR_OVER_PI)));
+        octant = _mm256_and_si256(_mm256_add_epi32(octant, _mm256_set1_epi32(1)), _mm256_set1_epi32(~1));
+        __m256 y = _mm256_cvtepi32_ps(octant);
+
+        sinSign = _mm256_xor_ps(sinSign, _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(octant, _mm256_set1_epi32(4)), 29)));
+        __m256 cosSign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_andnot_si256(_mm256_sub_epi32(octant, _mm256_set1_epi32(2)), _mm256_set1_epi32(4)), 29));
+        __m256 sinPolyMask = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(octant, _mm256_set1_epi32(2)), _mm256_setzero_si256()));
+
+        x = _mm256_fmadd_ps(y, _mm256_set1_ps(MINUS_DP1), x);
+        x = _mm256_fmadd_ps(y, _mm256_set1_ps(MINUS_DP2), x);
+        x = _mm256_fmadd_ps(y, _mm256_set1_ps(MINUS_DP3), x);
+        __m256 z = _mm256_mul_ps(x, x);
+
+        __m256 cosPoly = _mm256_fmadd_ps(_mm256_set1_ps(COS_P0), z, _mm256_set1_ps(COS_P1));
+        cosPoly = _mm256_fmadd_ps(cosPoly, z, _mm256_set1_ps(COS_P2));
+        cosPoly = _mm256_mul_ps(_mm256_mul_ps(cosPoly, z), z);
+        cosPoly = _mm256_add_ps(_mm256_fnmadd_ps(z, _mm256_set1_ps(0.5f), cosPoly), _mm256_set1_ps(1.0f));
+
+        __m256 sinPoly = _mm256_fmadd_ps(_mm256_set1_ps(SIN_P0), z, _mm256_set1_ps(SIN_P1));
+        sinPoly = _mm256_fmadd_ps(sinPoly, z, _mm256_set1_ps(SIN_P2));
+        sinPoly = _mm256_fmadd_ps(_mm256_mul_ps(sinPoly, z), x, x);
+
+        __m256 sinResult = _mm256_blendv_ps(cosPoly, sinPoly, sinPolyMask);
+        __m256 cosResult = _mm256_blendv_ps(sinPoly, cosPoly, sinPolyMask);
+        _mm256_storeu_ps(sines + i, _mm256_xor_ps(sinResult, sinSign));
+        _mm256_storeu_ps(cosines + i, _mm256_xor_ps(cosResult, cosSign));
+    }
+    SinCosScalar(degrees + i, sines + i, cosines + i, count - i);
+}
+
+SinCosKernel PickSimdSinCos()
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return SinCosAVX2;
+    }
+    return SinCosSSE2;
+}
+#else
+SinCosKernel PickSimdSinCos() { return SinCosScalar; }
+#endif
+
+// Runs kernel over [begin, end) one chunk section at a time
+void RunSinCosChunks(SinCosKernel kernel, int chunkSectionId, float const* degrees, float* sines, float* cosines, int begin, int end)
+{
+    for (int i = begin; i < end; i += TRIG_KERNEL_CHUNK)
+    {
+        int count = std::min(TRIG_KERNEL_CHUNK, end - i);
+        profiler->EnterSection(chunkSectionId);
+        kernel(degrees + i, sines + i, cosines + i, count);
+        profiler->AddItems(count); // The last chunk is short, so compare angles/s rather than chunk times
+        profiler->AddBytes(count * 3 * sizeof(float)); // One angle read, a sine and a cosine written
+        profiler->ExitSection(chunkSectionId);
+    }
+}
+
+// Splits the table across every hardware thread, each running the best SIMD kernel
+void SinCosMultithreaded(int chunkSectionId, float const* degrees, float* sines, float* cosines, int count)
+{
+    SinCosKernel kernel = PickSimdSinCos();
+    int numThreads = std::max(2u, std::thread::hardware_concurrency());
+    int perThread = (count / numThreads + TRIG_KERNEL_CHUNK - 1) / TRIG_KERNEL_CHUNK * TRIG_KERNEL_CHUNK;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < numThreads; t++)
+    {
+        int begin = std::min(count, t * perThread);
+        int end = std::min(count, begin + perThread);
+        threads.emplace_back(RunSinCosChunks, kernel, chunkSectionId, degrees, sines, cosines, begin, end);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+struct TrigKernelRun {
+    const char* sectionName;      // Whole-table section, compared against the steady_clock time
+    const char* chunkSectionName; // Per-chunk section inside it
+    SinCosKernel kernel;          // nullptr for the multithreaded run
+    int entries;
+    double wallSeconds;           // Independent steady_clock measurement around the section
+    float maxError;               // Against cosf/sinf over the same angles
+};
+
+void RunTrigKernelTest()
+{
+    constexpr int REPEATS = 3;
+    std::vector<float> degrees(TRIG_KERNEL_MT_NUM_ENTRIES);
+    for (float& angle : degrees) {
+        angle = 360.0f * float(rand()) / float(RAND_MAX);
+    }
+    std::vector<float> referenceSines(TRIG_KERNEL_MT_NUM_ENTRIES), referenceCosines(TRIG_KERNEL_MT_NUM_ENTRIES);
+    SinCosScalar(degrees.data(), referenceSines.data(), referenceCosines.data(), TRIG_KERNEL_MT_NUM_ENTRIES);
+    InitSinLookupTable();
+
+    std::vector<TrigKernelRun> runs = {
+        {"Trig Kernel Scalar", "Trig Kernel Scalar Chunk", SinCosScalar, TRIG_KERNEL_NUM_ENTRIES, 0.0, 0.f},
+#if defined(__x86_64__) || defined(__i386__)
+        {"Trig Kernel SSE2", "Trig Kernel SSE2 Chunk", SinCosSSE2, TRIG_KERNEL_NUM_ENTRIES, 0.0, 0.f},
+#endif
+        {"Trig Kernel Lookup Table", "Trig Kernel Lookup Table Chunk", SinCosLookup, TRIG_KERNEL_NUM_ENTRIES, 0.0, 0.f},
+        {"Trig Kernel Multithreaded", "Trig Kernel Multithreaded Chunk", nullptr, TRIG_KERNEL_MT_NUM_ENTRIES, 0.0, 0.f},
+    };
+#if defined(__x86_64__) || defined(__i386__)
+    if (PickSimdSinCos() == SinCosAVX2) {
+        runs.insert(runs.begin() + 2, {"Trig Kernel AVX2", "Trig Kernel AVX2 Chunk", SinCosAVX2, TRIG_KERNEL_NUM_ENTRIES, 0.0, 0.f});
+    } else {
+        std::cout << "AVX2/FMA not supported, skipping the AVX2 kernel" << std::endl;
+    }
+#endif
+
+    std::vector<float> sines(TRIG_KERNEL_MT_NUM_ENTRIES), cosines(TRIG_KERNEL_MT_NUM_ENTRIES);
+    for (TrigKernelRun& run : runs)
+    {
+        int sectionId = Profiler::RegisterSection(run.sectionName, __FILE__, __FUNCTION__, __LINE__);
+        int chunkSectionId = Profiler::RegisterSection(run.chunkSectionName, __FILE__, __FUNCTION__, __LINE__);
+        for (int repeat = 0; repeat < REPEATS; repeat++)
+        {
+            auto wallStart = std::chrono::steady_clock::now();
+            profiler->EnterSection(sectionId);
+            if (run.kernel) {
+                RunSinCosChunks(run.kernel, chunkSectionId, degrees.data(), sines.data(), cosines.data(), 0, run.entries);
+            } else {
+                SinCosMultithreaded(chunkSectionId, degrees.data(), sines.data(), cosines.data(), run.entries);
+            }
+            profiler->AddItems(run.entries);
+            profiler->AddBytes(run.entries * 3 * sizeof(float));
+            profiler->ExitSection(sectionId);
+            run.wallSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+        }
+        for (int i = 0; i < run.entries; i++)
+        {
+            run.maxError = std::max(run.maxError, std::fabs(sines[i] - referenceSines[i]));
+            run.maxError = std::max(run.maxError, std::fabs(cosines[i] - referenceCosines[i]));
+        }
+    }
+
+    // This test's window holds exactly the calls above
+    ProfilerSnapshot window = profiler->TakeSnapshot();
+    auto findStats = [&window](const char* sectionName) -> ProfilerStats const* {
+        for (ProfilerStats const& stats : window.stats) {
+            if (stats.count > 0 && strcmp(stats.sectionName, sectionName) == 0) {
+                return &stats;
+            }
+        }
+        return nullptr;
+    };
+
+    // Speedups are per angle so the larger multithreaded table compares fairly
+    double scalarProfiled = 0.0, scalarWall = 0.0;
+#ifndef __OPTIMIZE__
+    printf("\nUnoptimized build: the intrinsics kernels are not inlined, so their speedups are far below an -O2 build's\n");
+#endif
+    printf("\n%-28s %12s %12s %9s %9s %12s %12s %10s\n", "Kernel", "Profiled ns", "Wall ns", "Speedup", "(wall)",
+           "Chunk avg us", "Chunk share", "Max error");
+    for (TrigKernelRun const& run : runs)
+    {
+        ProfilerStats const* stats = findStats(run.sectionName);
+        ProfilerStats const* chunkStats = findStats(run.chunkSectionName);
+        if (!stats || !chunkStats) {
+            std::cerr << "Error: no profile for " << run.sectionName << std::endl;
+            continue;
+        }
+        double angles = double(run.entries) * REPEATS;
+        double profiledPerAngle = 1e9 * stats->totalTime / angles;
+        double wallPerAngle = 1e9 * run.wallSeconds / angles;
+        if (run.kernel == SinCosScalar) {
+            scalarProfiled = profiledPerAngle;
+            scalarWall = wallPerAngle;
+        }
+        // Chunk share above 100% means the chunks ran in parallel
+        printf("%-28s %12.3f %12.3f %8.2fx %8.2fx %12.3f %11.1f%% %10.2e\n", run.sectionName, profiledPerAngle, wallPerAngle,
+               scalarProfiled / profiledPerAngle, scalarWall / wallPerAngle, 1e6 * chunkStats->avgTime,
+               100.0 * chunkStats->totalTime / stats->totalTime, run.maxError);
+    }
+    std::cout << std::endl;
+}
 void RunTest() {
+    // One snapshot window per test, the way a long-running process would take one per frame or interval
     RunInterleavedTest(); // Call the interleaved profiling 
+    profiler->TakeSnapshot();
     Test1();
+    profiler->TakeSnapshot();
     Test2();
+    profiler->TakeSnapshot();
+    profiler->SetCpuTime(true); // Two system calls per enter and exit, so only where blocking is expected
+    RunMultithreadedTest();
+    profiler->SetCpuTime(false);
+    profiler->TakeSnapshot();
+    RunAsyncTest();
+    profiler->TakeSnapshot();
+    RunTaggedRequestTest();
+    profiler->TakeSnapshot();
+    RunTrigKernelTest(); // Takes its own snapshot to compare against steady_clock
 }
 
-int main(int argc, char** argv)
+int main()
 {
     profiler = Profiler::GetInstance();
+    profiler->StartTrace("profiler_trace.bin"); // Stream every call to disk with bounded memory
+    profiler->StartLiveStats(); // Watch while it runs with profiler_live --pid <this process>
+    profiler->SetPerfCounters(true); // IPC and miss rates per section; timing only where there is no PMU
+#ifdef PROFILER_TRACK_ALLOCATIONS
+    Profiler::SetAllocationTracking(true); // Heap traffic per section (make PROFILER_FLAGS=-DPROFILER_TRACK_ALLOCATIONS)
+#endif
 
     RunTest();
 
+    profiler->StopLiveStats();
+    profiler->StopTrace();
+    ExportTraceToChromeJSON("profiler_trace.bin", "profiler_trace.json"); // Open in Perfetto or chrome://tracing
+
     profiler->printStatsToCSV("profiler_stats.csv"); // Output statistics to a CSV file
     profiler->printStatsToJSON("profiler_stats.json"); // Output statistics to a JSON file
+    profiler->printSnapshotsToJSON("profiler_windows.json"); // Per-window stats for trend reporting
     profiler->printStats(); // Print stats to console
+    profiler->printSnapshots();
 
     // Clean up
     delete profiler; 
@@ -0,0 +1,193 @@
+#include "perf_counters.hpp"
+
+#include <cerrno>
+#include <cstring>
+
+#if PROFILER_HAS_PERF_EVENTS
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+#if PROFILER_HAS_PERF_EVENTS
+    const uint64_t counterConfigs[PERF_COUNTER_COUNT] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_BRANCH_MISSES,
+    };
+
+    int OpenCounter(uint64_t config, int groupFd)
+    {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = config;
+        attr.exclude_kernel = 1;             // Required unless perf_event_paranoid < 2, and kernel time isn't ours to tune
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+        return (int)syscall(SYS_perf_event_open, &attr, 0, -1, groupFd, 0); // This thread, any CPU
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    inline uint64_t ReadPmc(uint32_t counter)
+    {
+        uint32_t low, high;
+        __asm__ volatile("rdpmc" : "=a"(low), "=d"(high) : "c"(counter));
+        return ((uint64_t)high << 32) | low;
+    }
+#endif
+#endif
+}
+
+const char* GetPerfCounterName(int kind)
+{
+    static const char* const names[PERF_COUNTER_COUNT] = { "cycles", "instructions", "cacheMisses", "branchMisses" };
+    return (kind >= 0 && kind < PERF_COUNTER_COUNT) ? names[kind] : "unknown";
+}
+
+PerfCounterGroup::PerfCounterGroup()
+    : groupSize(0), availableMask(0), useRdpmc(false), error(nullptr)
+{
+    for (int kind = 0; kind < PERF_COUNTER_COUNT; ++kind) {
+        fds[kind] = -1;
+        pages[kind] = nullptr;
+        groupSlot[kind] = -1;
+    }
+}
+
+PerfCounterGroup::~PerfCounterGroup()
+{
+    Close();
+}
+
+bool PerfCounterGroup::Open()
+{
+    Close();
+#if PROFILER_HAS_PERF_EVENTS
+    fds[PerfCycles] = OpenCounter(counterConfigs[PerfCycles], -1);
+    if (fds[PerfCycles] < 0) {
+        // ENOENT: no PMU (common in VMs); EACCES/EPERM: perf_event_paranoid or seccomp
+        error = (errno == ENOENT || errno == EOPNOTSUPP) ? "no hardware counters on this machine"
+              : (errno == EACCES || errno == EPERM) ? "perf_event_open not permitted" : "perf_event_open failed";
+        return false;
+    }
+    groupSlot[PerfCycles] = groupSize++;
+    availableMask = 1u << PerfCycles;
+
+    for (int kind = PerfCycles + 1; kind < PERF_COUNTER_COUNT; ++kind) {
+        fds[kind] = OpenCounter(counterConfigs[kind], fds[PerfCycles]);
+        if (fds[kind] >= 0) {
+            groupSlot[kind] = groupSize++;
+            availableMask |= 1u << kind;
+        }
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    // rdpmc needs every open counter's page to advertise user-space reads
+    useRdpmc = true;
+    long pageSize = sysconf(_SC_PAGESIZE);
+    for (int kind = 0; kind < PERF_COUNTER_COUNT; ++kind) {
+        if (fds[kind] < 0) {
+            continue;
+        }
+        void* page = mmap(nullptr, (size_t)pageSize, PROT_READ, MAP_SHARED, fds[kind], 0);
+        if (page == MAP_FAILED) {
+            useRdpmc = false;
+            continue;
+        }
+        pages[kind] = page;
+        if (!static_cast<perf_event_mmap_page*>(page)->cap_user_rdpmc) {
+            useRdpmc = false;
+        }
+    }
+#endif
+    return true;
+#else
+    error = "perf_event_open is Linux-only";
+    return false;
+#endif
+}
+
+void PerfCounterGroup::Close()
+{
+#if PROFILER_HAS_PERF_EVENTS
+    long pageSize = sysconf(_SC_PAGESIZE);
+    for (int kind = PERF_COUNTER_COUNT - 1; kind >= 0; --kind) {
+        if (pages[kind]) {
+            munmap(pages[kind], (size_t)pageSize);
+            pages[kind] = nullptr;
+        }
+        if (fds[kind] >= 0) {
+            close(fds[kind]); // Members before the leader
+            fds[kind] = -1;
+        }
+        groupSlot[kind] = -1;
+    }
+#endif
+    groupSize = 0;
+    availableMask = 0;
+    useRdpmc = false;
+}
+
+void PerfCounterGroup::Read(uint64_t* values)
+{
+    if (!IsOpen()) {
+        memset(values, 0, PERF_COUNTER_COUNT * sizeof(uint64_t));
+        return;
+    }
+    if (!useRdpmc || !ReadWithRdpmc(values)) {
+        ReadWithSyscall(values);
+    }
+}
+
+// The self-monitoring protocol from perf_event_open(2): retry while the kernel updates the page,
+// and give up (falling back to read()) if a counter is not currently scheduled on the PMU
+bool PerfCounterGroup::ReadWithRdpmc(uint64_t* values)
+{
+#if PROFILER_HAS_PERF_EVENTS && (defined(__x86_64__) || defined(__i386__))
+    for (int kind = 0; kind < PERF_COUNTER_COUNT; ++kind) {
+        perf_event_mmap_page volatile* page = static_cast<perf_event_mmap_page volatile*>(pages[kind]);
+        if (!page) {
+            values[kind] = 0;
+            continue;
+        }
+        uint32_t sequence;
+        uint64_t count;
+        do {
+            sequence = page->lock;
+            __asm__ volatile("" ::: "memory");
+            uint32_t index = page->index;
+            if (index == 0) {
+                return false;
+            }
+            count = page->offset;
+            uint16_t width = page->pmc_width;
+            int64_t pmc = (int64_t)(ReadPmc(index - 1) << (64 - width)) >> (64 - width); // Sign-extend
+            count += pmc;
+            __asm__ volatile("" ::: "memory");
+        } while (page->lock != sequence);
+        values[kind] = count;
+    }
+    return true;
+#else
+    (void)values;
+    return false;
+#endif
+}
+
+void PerfCounterGroup::ReadWithSyscall(uint64_t* values)
+{
+    uint64_t buffer[1 + PERF_COUNTER_COUNT] = {}; // PERF_FORMAT_GROUP: nr, then one value per member
+#if PROFILER_HAS_PERF_EVENTS
+    if (read(fds[PerfCycles], buffer, sizeof(buffer)) < (ssize_t)sizeof(uint64_t)) {
+        memset(buffer, 0, sizeof(buffer));
+    }
+#endif
+    for (int kind = 0; kind < PERF_COUNTER_COUNT; ++kind) {
+        values[kind] = (groupSlot[kind] >= 0 && (uint64_t)groupSlot[kind] < buffer[0]) ? buffer[1 + groupSlot[kind]] : 0;
+    }
+}
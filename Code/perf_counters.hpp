@@ -0,0 +1,48 @@
+// include/perf_counters.hpp
+#pragma once
+
+#include <cstdint>
+
+#if defined(__linux__)
+#define PROFILER_HAS_PERF_EVENTS 1
+#else
+#define PROFILER_HAS_PERF_EVENTS 0
+#endif
+
+// Hardware counters read around each timed section when Profiler::SetPerfCounters is on
+enum PerfCounterKind { PerfCycles, PerfInstructions, PerfCacheMisses, PerfBranchMisses, PERF_COUNTER_COUNT };
+
+const char* GetPerfCounterName(int kind);   // JSON-style names: "cycles", "instructions", ...
+
+struct PerfCounterValues {
+    uint64_t values[PERF_COUNTER_COUNT];
+};
+
+// One thread's counter group, opened through perf_event_open for the calling thread only
+// (user space, so it works at perf_event_paranoid 2). Counters are read with rdpmc from the
+// mmapped event pages when the kernel allows it, otherwise with one read() of the whole group.
+class PerfCounterGroup {
+    public:
+        PerfCounterGroup();
+        ~PerfCounterGroup();
+
+        bool Open();                         // From the thread to be measured; false if cycles are unavailable
+        void Close();
+        bool IsOpen() const { return fds[PerfCycles] >= 0; }
+        uint32_t GetAvailableMask() const { return availableMask; } // Bit per PerfCounterKind that opened
+        const char* GetError() const { return error; }
+
+        void Read(uint64_t* values);         // PERF_COUNTER_COUNT values; counters that failed to open read 0
+
+    private:
+        bool ReadWithRdpmc(uint64_t* values);
+        void ReadWithSyscall(uint64_t* values);
+
+        int fds[PERF_COUNTER_COUNT];
+        void* pages[PERF_COUNTER_COUNT];     // perf_event_mmap_page per counter, for rdpmc
+        int groupSlot[PERF_COUNTER_COUNT];   // Position in a group read(), -1 if not open
+        int groupSize;
+        uint32_t availableMask;
+        bool useRdpmc;
+        const char* error;                   // Why Open failed, for the one-time warning
+};
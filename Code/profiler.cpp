@@ -1,283 +1,2242 @@
 #include "profiler.hpp"
 
 #include "time.hpp"
+#include "thread_usage.hpp"
+#include "intern.hpp"
+#include "trace_export.hpp"
 #include <iostream>
+#include <deque>
+#include <algorithm>
+#include <cstdlib>
+#include <cmath>
 
 
 
 Profiler* Profiler::gProfiler = nullptr; 
+std::atomic<unsigned long long> Profiler::nextInstanceId(0);
+std::atomic<unsigned> Profiler::samplingGeneration(0);
+std::atomic<bool> Profiler::allocationTracking(false);
+std::atomic<size_t> Profiler::slowCallCapacity(5);
 
-TimeRecordStart:: TimeRecordStart (char const* sectionName, double secondsAtStart):sectionName(sectionName), secondsAtStart(secondsAtStart){}
+TimeRecordStart:: TimeRecordStart (int sectionId, uint64_t ticksAtStart, int callTreeNode, bool sampled, bool counted, bool cpuTimed)
+    :sectionId(sectionId), ticksAtStart(ticksAtStart), callTreeNode(callTreeNode), sampled(sampled), counted(counted), cpuTimed(cpuTimed){}
 
 
-TimeRecordStop:: TimeRecordStop(char const* sectionName, double secondsAtStop, int lineNumber, const char* fileName, const char* functionName):sectionName(sectionName), secondsAtStop(secondsAtStop){}
-TimeRecordStop:: TimeRecordStop(char const* sectionName, double secondsAtStop){} 
+TimeRecordStart::~TimeRecordStart(){}
+
+namespace {
+    // Process-wide table of sections. It outlives any Profiler instance because call sites
+    // hold their ids in function-local statics. Names are looked up through the interned strings,
+    // whose per-string value holds sectionId * 2 + 1 once the section has a source location.
+    struct SectionRegistry {
+        std::mutex mutex;
+        std::vector<ProfilerCallSite> sections;  // Indexed by sectionId; names point into the intern table
+        std::vector<ProfilerSamplingPolicy> policies; // Indexed by sectionId
+        std::vector<ProfilerTagGroup> tagGroups; // Indexed by tag group id
+        std::unordered_map<uint64_t, int> tagGroupIds; // sectionId << 32 | tagId -> tag group id
+    };
+
+    // Each thread caches its buffer; the instance id guards against a deleted and recreated Profiler.
+    // Plain data with a constant initializer, so the allocation hooks can read it at any point.
+    struct ThreadCache {
+        unsigned long long instanceId;
+        ThreadProfilerData* data;
+        int allocationPause;                     // Nonzero while the profiler grows this thread's buffers
+    };
+    thread_local ThreadCache threadCache = { 0, nullptr, 0 };
+
+    // Leaves the profiler's own allocations uncharged while it grows the calling thread's buffers.
+    // They are not the section's, and a hook firing while callTree reallocates would count into the
+    // storage being released.
+    struct AllocationPause {
+        AllocationPause() { ++threadCache.allocationPause; }
+        ~AllocationPause() { --threadCache.allocationPause; }
+    };
+
+    // Retires the thread's buffer when the thread exits. Kept apart from ThreadCache, which has to
+    // stay trivially destructible for the allocation hooks; constructed on registration only.
+    struct ThreadExitHook {
+        ~ThreadExitHook()
+        {
+            if (threadCache.data && Profiler::gProfiler) {
+                Profiler::gProfiler->ReleaseThreadData();
+            }
+        }
+    };
+    thread_local ThreadExitHook threadExitHook;
+
+    // Per-section totals of one thread's harvested stats, leaving out the sections it never ran
+    ThreadStatsReport SummarizeThread(ThreadProfilerData const& data, bool exited)
+    {
+        ThreadStatsReport report{data.threadIndex, data.osThreadId, exited, {}};
+        for (ProfilerStats const& harvested: data.harvestedStats) {
+            if (harvested.count == 0) {
+                continue;
+            }
+            ProfilerStats s = harvested;
+            s.ExtrapolateSamples();
+            s.UpdateTimes();
+            report.sections.push_back(ThreadSectionTotals{s.sectionId, s.count, s.totalTime, s.avgTime, s.cpuCalls,
+                                                          s.cpuTime, s.cpuUtilization, s.voluntarySwitches,
+                                                          s.involuntarySwitches});
+        }
+        return report;
+    }
+
+    SectionRegistry& GetSectionRegistry()
+    {
+        static SectionRegistry registry;
+        return registry;
+    }
+
+    // Appends empty stats for tag groups registered since stats was last grown
+    void GrowTagStats(std::vector<ProfilerStats>& stats, int tagGroupCount)
+    {
+        if ((int)stats.size() >= tagGroupCount) {
+            return;
+        }
+        stats.reserve(tagGroupCount);
+        for (int id = (int)stats.size(); id < tagGroupCount; ++id) {
+            ProfilerCallSite section = Profiler::GetSectionInfo(Profiler::GetTagGroup(id).sectionId);
+            stats.emplace_back(section.sectionName, section.fileName, section.functionName, section.lineNumber, section.sectionId);
+        }
+    }
+
+    // Orders tag groups by tag, then by section, so each tag's sections print together
+    std::vector<int> TagGroupsByTag(std::vector<ProfilerStats> const& tagStats)
+    {
+        std::vector<int> order;
+        for (int tagGroup = 0; tagGroup < (int)tagStats.size(); ++tagGroup) {
+            if (tagStats[tagGroup].count > 0) {
+                order.push_back(tagGroup);
+            }
+        }
+        std::sort(order.begin(), order.end(), [](int a, int b) {
+            ProfilerTagGroup groupA = Profiler::GetTagGroup(a);
+            ProfilerTagGroup groupB = Profiler::GetTagGroup(b);
+            return groupA.tagId != groupB.tagId ? groupA.tagId < groupB.tagId : groupA.sectionId < groupB.sectionId;
+        });
+        return order;
+    }
+
+    // Adds from's subtree under fromNode to into's tree under intoNode, matching paths by section id
+    void FoldCallTree(ThreadProfilerData& into, ThreadProfilerData const& from, int fromNode, int intoNode)
+    {
+        for (int child = from.callTree[fromNode].firstChild; child != -1; child = from.callTree[child].nextSibling) {
+            CallTreeNode const& source = from.callTree[child];
+            int folded = into.GetChildNode(intoNode, source.sectionId);
+            CallTreeNode& target = into.callTree[folded];
+            target.count += source.count;
+            target.sampledCount += source.sampledCount;
+            target.inclusiveTicks += source.inclusiveTicks;
+            target.childTicks += source.childTicks;
+            target.allocations += source.allocations;
+            target.allocatedBytes += source.allocatedBytes;
+            target.frees += source.frees;
+            FoldCallTree(into, from, child, folded);
+        }
+    }
+
+    // Quotes a CSV field when it holds a comma, quote or line break, doubling any quotes (RFC 4180)
+    std::string EscapeCSV(char const* text)
+    {
+        std::string field(text ? text : "");
+        if (field.find_first_of(",\"\r\n") == std::string::npos) {
+            return field;
+        }
+        std::string quoted = "\"";
+        for (char c: field) {
+            quoted += c;
+            if (c == '"') {
+                quoted += '"';
+            }
+        }
+        return quoted + "\"";
+    }
+
+    // Appends empty stats for sections registered since stats was last grown
+    void GrowStats(std::vector<ProfilerStats>& stats, int sectionCount)
+    {
+        if ((int)stats.size() >= sectionCount) {
+            return;
+        }
+        stats.reserve(sectionCount);
+        for (int id = (int)stats.size(); id < sectionCount; ++id) {
+            ProfilerCallSite section = Profiler::GetSectionInfo(id);
+            stats.emplace_back(section.sectionName, section.fileName, section.functionName, section.lineNumber, id);
+        }
+    }
+}
+
+ProfilerCallSite::ProfilerCallSite(char const* sectionName, const char* fileName, const char* functionName, int lineNumber)
+    :sectionName(sectionName), fileName(fileName), functionName(functionName), lineNumber(lineNumber)
+{
+    sectionId = Profiler::RegisterSection(sectionName, fileName, functionName, lineNumber);
+}
+
+ProfilerCallSite::ProfilerCallSite(char const* sectionName, const char* fileName, const char* functionName, int lineNumber, int sectionId)
+    :sectionName(sectionName), fileName(fileName), functionName(functionName), lineNumber(lineNumber), sectionId(sectionId)
+{
+}
+
+int Profiler::RegisterSection(char const* sectionName, const char* fileName, const char* functionName, int lineNumber)
+{
+    // Known sections resolve without a lock: hash the name, probe the intern table, read the value
+    InternTable& strings = GetInternedStrings();
+    int nameId = strings.Intern(sectionName);
+    int known = strings.GetValue(nameId);
+    if (known >= 0 && (!fileName || (known & 1))) {
+        return known >> 1;
+    }
+
+    SectionRegistry& registry = GetSectionRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    known = strings.GetValue(nameId);
+    if (known >= 0) {
+        int sectionId = known >> 1;
+        ProfilerCallSite& section = registry.sections[sectionId];
+        if (!section.fileName && fileName) {
+            // Sections first seen through the name-based API pick up the first real location
+            section.fileName = fileName;
+            section.functionName = functionName;
+            section.lineNumber = lineNumber;
+            strings.SetValue(nameId, sectionId * 2 + 1);
+        }
+        return sectionId;
+    }
+
+    int sectionId = (int)registry.sections.size();
+    registry.sections.emplace_back(strings.GetString(nameId), fileName, functionName, lineNumber, sectionId);
+    registry.policies.emplace_back();
+    strings.SetValue(nameId, sectionId * 2 + (fileName ? 1 : 0));
+    return sectionId;
+}
+
+// A tag is the interned string key '\0' value, so tag ids never collide with section names
+int Profiler::InternTag(char const* key, char const* value)
+{
+    size_t keyLength = strlen(key);
+    size_t valueLength = strlen(value);
+    char buffer[256];
+    std::string longTag;
+    char* text = buffer;
+    if (keyLength + 1 + valueLength > sizeof(buffer)) {
+        longTag.resize(keyLength + 1 + valueLength);
+        text = &longTag[0];
+    }
+    memcpy(text, key, keyLength);
+    text[keyLength] = '\0';
+    memcpy(text + keyLength + 1, value, valueLength);
+    return GetInternedStrings().Intern(text, keyLength + 1 + valueLength);
+}
+
+char const* Profiler::GetTagKey(int tagId)
+{
+    return GetInternedStrings().GetString(tagId);
+}
+
+char const* Profiler::GetTagValue(int tagId)
+{
+    char const* key = GetInternedStrings().GetString(tagId);
+    return key + strlen(key) + 1;
+}
+
+int Profiler::RegisterTagGroup(int sectionId, int tagId)
+{
+    SectionRegistry& registry = GetSectionRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    uint64_t key = ((uint64_t)sectionId << 32) | (uint32_t)tagId;
+    auto found = registry.tagGroupIds.find(key);
+    if (found != registry.tagGroupIds.end()) {
+        return found->second;
+    }
+    int tagGroup = (int)registry.tagGroups.size();
+    registry.tagGroups.push_back(ProfilerTagGroup{sectionId, tagId});
+    registry.tagGroupIds.emplace(key, tagGroup);
+    return tagGroup;
+}
+
+ProfilerTagGroup Profiler::GetTagGroup(int tagGroup)
+{
+    SectionRegistry& registry = GetSectionRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    return registry.tagGroups[tagGroup];
+}
+
+int Profiler::GetTagGroupCount()
+{
+    SectionRegistry& registry = GetSectionRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    return (int)registry.tagGroups.size();
+}
+
+int Profiler::GetSectionCount()
+{
+    SectionRegistry& registry = GetSectionRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    return (int)registry.sections.size();
+}
+
+ProfilerCallSite Profiler::GetSectionInfo(int sectionId)
+{
+    SectionRegistry& registry = GetSectionRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    return registry.sections[sectionId];
+}
+
+void Profiler::SetSamplingPolicy(int sectionId, ProfilerSamplingPolicy const& policy)
+{
+    SectionRegistry& registry = GetSectionRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.policies[sectionId] = policy;
+    samplingGeneration.fetch_add(1, std::memory_order_release);
+}
+
+void Profiler::SetSamplingPolicy(char const* sectionName, ProfilerSamplingPolicy const& policy)
+{
+    SetSamplingPolicy(RegisterSection(sectionName, nullptr, nullptr, 0), policy);
+}
+
+ProfilerSamplingPolicy Profiler::GetSamplingPolicy(int sectionId)
+{
+    SectionRegistry& registry = GetSectionRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    return registry.policies[sectionId];
+}
+
+ProfilerSamplingPolicy ProfilerSamplingPolicy::OneIn(uint32_t rate)
+{
+    ProfilerSamplingPolicy policy;
+    policy.mode = FixedRate;
+    policy.rate = rate > 0 ? rate : 1;
+    return policy;
+}
+
+ProfilerSamplingPolicy ProfilerSamplingPolicy::Interval(double seconds)
+{
+    ProfilerSamplingPolicy policy;
+    policy.mode = TimeInterval;
+    policy.intervalSeconds = seconds;
+    return policy;
+}
+
+ProfilerSamplingPolicy ProfilerSamplingPolicy::AdaptiveLimit(double maxCallsPerSecond)
+{
+    ProfilerSamplingPolicy policy;
+    policy.mode = Adaptive;
+    policy.maxCallsPerSecond = maxCallsPerSecond;
+    return policy;
+}
+
+std::string ProfilerSamplingPolicy::Describe() const
+{
+    char text[64];
+    switch (mode) {
+        case FixedRate:
+            snprintf(text, sizeof(text), "1 in %u calls", rate);
+            break;
+        case TimeInterval:
+            snprintf(text, sizeof(text), "every %gms", 1000.0 * intervalSeconds);
+            break;
+        case Adaptive:
+            snprintf(text, sizeof(text), "adaptive, at most %g timed calls/s", maxCallsPerSecond);
+            break;
+        default:
+            snprintf(text, sizeof(text), "every call");
+            break;
+    }
+    return text;
+}
+
+void SectionSampler::Reset(ProfilerSamplingPolicy const& policy)
+{
+    mode = policy.mode;
+    rate = (policy.mode == ProfilerSamplingPolicy::FixedRate) ? policy.rate : 1;
+    countdown = rate;
+    intervalTicks = 0;
+    if (policy.mode == ProfilerSamplingPolicy::TimeInterval) {
+        intervalTicks = (uint64_t)(policy.intervalSeconds / GetSecondsPerTick());
+    } else if (policy.mode == ProfilerSamplingPolicy::Adaptive) {
+        intervalTicks = (uint64_t)(0.1 / GetSecondsPerTick()); // Re-measure the call rate every 100ms
+    }
+    nextSampleTicks = 0;
+    windowStartTicks = 0;
+    windowCalls = 0;
+    maxCallsPerSecond = policy.maxCallsPerSecond;
+}
+
+bool SectionSampler::Sample()
+{
+    switch (mode) {
+        case ProfilerSamplingPolicy::FixedRate:
+            if (--countdown != 0) {
+                return false;
+            }
+            countdown = rate;
+            return true;
+
+        case ProfilerSamplingPolicy::TimeInterval: {
+            uint64_t now = GetCurrentTimeTicks();
+            if (now < nextSampleTicks) {
+                return false;
+            }
+            nextSampleTicks = now + intervalTicks;
+            return true;
+        }
+
+        case ProfilerSamplingPolicy::Adaptive: {
+            // Between timed calls this is just a counter; the clock is only read on timed calls
+            windowCalls++;
+            if (--countdown != 0) {
+                return false;
+            }
+            uint64_t now = GetCurrentTimeTicks();
+            if (windowStartTicks == 0) {
+                windowStartTicks = now;
+            } else if (now - windowStartTicks >= intervalTicks) {
+                double callsPerSecond = double(windowCalls) / TicksToSeconds(now - windowStartTicks);
+                double newRate = (maxCallsPerSecond > 0.0) ? callsPerSecond / maxCallsPerSecond : 1.0;
+                rate = newRate > 1.0 ? (uint32_t)(newRate + 0.5) : 1;
+                windowStartTicks = now;
+                windowCalls = 0;
+            }
+            countdown = rate;
+            return true;
+        }
+
+        default:
+            return true;
+    }
+}
+
+Profiler:: Profiler() : nextThreadIndex(0), tracing(false), overheadPairTicks(0), overheadInnerTicks(0), compensateOverhead(false),
+    perfCountersEnabled(false), cpuTimeEnabled(false), snapshotHistory(60), snapshotCount(0), snapshotStopping(false)
+{
+    gProfiler = this; 
+    InitializeClock();
+    const char* perfCounters = getenv("PROFILER_PERF_COUNTERS");
+    if (perfCounters && strcmp(perfCounters, "0") != 0) {
+        perfCountersEnabled.store(true);
+    }
+    const char* cpuTime = getenv("PROFILER_CPU_TIME");
+    if (cpuTime && strcmp(cpuTime, "0") != 0) {
+        cpuTimeEnabled.store(true);
+    }
+    windowStartTicks = GetCurrentTimeTicks();
+    instanceId = ++nextInstanceId;
+    threadData.reserve(64);
+    retiredThreads.reset(new ThreadProfilerData(std::this_thread::get_id(), -1));
+    spanPaths.emplace_back(-1, -1); // Root
+    CalibrateOverhead();
+
+}
+Profiler* Profiler::CreateInstance()
+{
+    if(gProfiler == nullptr)
+    {
+        gProfiler = new Profiler(); 
+    }
+
+    return gProfiler; 
+}
+Profiler::~Profiler()
+{
+    StopSnapshotTimer();
+    StopLiveStats();
+    StopTrace();
+    if (gProfiler == this)
+    {
+        gProfiler = nullptr;
+    }
+}
+
+CallTreeNode::CallTreeNode(int sectionId, int parent)
+    :sectionId(sectionId), parent(parent), firstChild(-1), lastChild(-1), nextSibling(-1), count(0), sampledCount(0), inclusiveTicks(0), childTicks(0),
+     allocations(0), allocatedBytes(0), frees(0), async(false)
+{
+}
+
+ThreadProfilerData::ThreadProfilerData(std::thread::id threadId, int threadIndex)
+    :threadId(threadId), threadIndex(threadIndex), osThreadId(GetCurrentThreadOsId()), activeStats(0), recordingStats(false),
+     currentNode(0), perfState(0), cpuState(0)
+{
+    startTimes.reserve(100);
+    traceChunk = nullptr;
+    traceChunkSequence = 0;
+    callTree.reserve(64);
+    callTree.emplace_back(-1, -1); // Root
+    samplingGeneration = Profiler::samplingGeneration.load(std::memory_order_acquire);
+}
+
+ThreadProfilerData::~ThreadProfilerData()
+{
+}
+
+ProfilerStats& ThreadProfilerData::GetTagStats(int buffer, int tagGroup)
+{
+    if ((size_t)tagGroup >= tagStats[buffer].size()) {
+        AllocationPause pause;
+        GrowTagStats(tagStats[buffer], Profiler::GetTagGroupCount());
+    }
+    return tagStats[buffer][tagGroup];
+}
+
+ProfilerStats& ThreadProfilerData::GetStats(int buffer, int sectionId)
+{
+    if ((size_t)sectionId >= stats[buffer].size()) {
+        // Only happens the first time this buffer sees a newly registered section
+        AllocationPause pause;
+        GrowStats(stats[buffer], Profiler::GetSectionCount());
+    }
+    return stats[buffer][sectionId];
+}
+
+SectionSampler& ThreadProfilerData::GetSampler(int sectionId)
+{
+    unsigned generation = Profiler::samplingGeneration.load(std::memory_order_acquire);
+    if (generation != samplingGeneration) {
+        samplingGeneration = generation;
+        for (size_t id = 0; id < samplers.size(); ++id) {
+            samplers[id].Reset(Profiler::GetSamplingPolicy((int)id));
+        }
+    }
+    if ((size_t)sectionId >= samplers.size()) {
+        AllocationPause pause;
+        int sectionCount = Profiler::GetSectionCount();
+        for (int id = (int)samplers.size(); id < sectionCount; ++id) {
+            samplers.emplace_back();
+            samplers.back().Reset(Profiler::GetSamplingPolicy(id));
+        }
+    }
+    return samplers[sectionId];
+}
+
+int ThreadProfilerData::GetChildNode(int parent, int sectionId)
+{
+    // Most parents have one child, entered over and over in a loop; that case skips the hash
+    int first = callTree[parent].firstChild;
+    if (first != -1 && callTree[first].sectionId == sectionId) {
+        return first;
+    }
+
+    // A parent may fan out to thousands of children (one per request type or shard), so no sibling walk
+    uint64_t key = ((uint64_t)parent << 32) | (uint32_t)sectionId;
+    auto found = childNodes.find(key);
+    if (found != childNodes.end()) {
+        return found->second;
+    }
+
+    // New paths go at the end of the sibling list so children stay in first-seen order
+    AllocationPause pause;
+    int child = (int)callTree.size();
+    callTree.emplace_back(sectionId, parent);
+    if (first == -1) {
+        callTree[parent].firstChild = child;
+    } else {
+        callTree[callTree[parent].lastChild].nextSibling = child;
+    }
+    callTree[parent].lastChild = child;
+    childNodes.emplace(key, child);
+    return child;
+}
+
+void ProfilerStats::Merge(ProfilerStats const& other)
+{
+    count += other.count;
+    sampledCount += other.sampledCount;
+    totalTicks += other.totalTicks;
+    sampledTicks += other.sampledTicks;
+    sumSquaredTicks += other.sumSquaredTicks;
+    if (other.minTicks < minTicks) {
+        minTicks = other.minTicks;
+    }
+    if (other.maxTicks > maxTicks) {
+        maxTicks = other.maxTicks;
+    }
+    if (other.firstStartTicks < firstStartTicks) {
+        firstStartTicks = other.firstStartTicks;
+    }
+    if (other.lastStopTicks > lastStopTicks) {
+        lastStopTicks = other.lastStopTicks;
+    }
+    histogram.Merge(other.histogram);
+    for (int kind = 0; kind < PERF_COUNTER_COUNT; ++kind) {
+        perfCounts[kind] += other.perfCounts[kind];
+    }
+    perfCalls += other.perfCalls;
+    perfCounterMask |= other.perfCounterMask;
+    cpuNanoseconds += other.cpuNanoseconds;
+    voluntarySwitches += other.voluntarySwitches;
+    involuntarySwitches += other.involuntarySwitches;
+    cpuCalls += other.cpuCalls;
+    items += other.items;
+    bytes += other.bytes;
+
+    if (!other.slowestCalls.empty()) {
+        size_t capacity = Profiler::GetSlowCallCapacity();
+        slowestCalls.insert(slowestCalls.end(), other.slowestCalls.begin(), other.slowestCalls.end());
+        std::stable_sort(slowestCalls.begin(), slowestCalls.end(), [](SlowCall const& a, SlowCall const& b) {
+            return a.ticks > b.ticks;
+        });
+        if (slowestCalls.size() > capacity) {
+            slowestCalls.resize(capacity);
+        }
+        slowCallThresholdTicks = (capacity > 0 && slowestCalls.size() == capacity) ? slowestCalls.back().ticks : 0;
+    }
+}
+
+void ProfilerStats::RecordCall(uint64_t ticksAtStart, uint64_t ticksAtStop)
+{
+    uint64_t elapsedTicks = ticksAtStop - ticksAtStart;
+    count++;
+    sampledCount++;
+    totalTicks += elapsedTicks;
+    sampledTicks += elapsedTicks;
+    sumSquaredTicks += double(elapsedTicks) * double(elapsedTicks);
+
+    // Update min and max; seconds and the average are derived at report time
+    if (elapsedTicks < minTicks) {
+        minTicks = elapsedTicks; // Update minimum time
+    }
+    if (elapsedTicks > maxTicks) {
+        maxTicks = elapsedTicks; // Update maximum time
+    }
+    if (ticksAtStart < firstStartTicks) {
+        firstStartTicks = ticksAtStart;
+    }
+    if (ticksAtStop > lastStopTicks) {
+        lastStopTicks = ticksAtStop;
+    }
+    histogram.Record(elapsedTicks);
+}
+
+SlowCall& ProfilerStats::AddSlowCall(uint64_t ticks)
+{
+    size_t capacity = Profiler::GetSlowCallCapacity();
+    if (slowestCalls.size() > capacity) {
+        slowestCalls.resize(capacity); // Capacity was lowered since the last call
+    }
+    if (slowestCalls.size() < capacity) {
+        slowestCalls.emplace_back();
+    }
+    // Otherwise the fastest entry is overwritten, reusing its stack's storage
+    size_t slot = slowestCalls.size() - 1;
+    while (slot > 0 && slowestCalls[slot - 1].ticks < ticks) {
+        std::swap(slowestCalls[slot], slowestCalls[slot - 1]);
+        --slot;
+    }
+    slowestCalls[slot].ticks = ticks;
+    slowCallThresholdTicks = (slowestCalls.size() == capacity) ? slowestCalls.back().ticks : 0;
+    return slowestCalls[slot];
+}
+
+void ProfilerStats::Reset()
+{
+    *this = ProfilerStats(sectionName, fileName, functionName, lineNumber, sectionId);
+}
+
+void ProfilerStats::ExtrapolateSamples()
+{
+    if (sampledCount > 0 && sampledCount < count) {
+        totalTicks = (uint64_t)(double(totalTicks) * double(count) / double(sampledCount));
+    }
+}
+
+void ProfilerStats::UpdateTimes()
+{
+    totalTime = TicksToSeconds(totalTicks);
+    minTime = (count > 0) ? TicksToSeconds(minTicks) : 0.0;
+    maxTime = TicksToSeconds(maxTicks);
+    avgTime = (count > 0) ? (totalTime / count) : 0.0;
+
+    // From the raw sums, so neither extrapolation nor overhead compensation (a per-call shift) skews it
+    if (sampledCount > 1) {
+        double mean = double(sampledTicks) / sampledCount;
+        double variance = (sumSquaredTicks - mean * double(sampledTicks)) / (sampledCount - 1);
+        stdDevTime = (variance > 0.0) ? std::sqrt(variance) * GetSecondsPerTick() : 0.0;
+    } else {
+        stdDevTime = 0.0;
+    }
+    exclusiveTime = TicksToSeconds(exclusiveTicks);
+    startTime = (count > 0) ? TicksToSeconds(firstStartTicks - GetClockStartTicks()) : 0.0;
+    endTime = (count > 0) ? TicksToSeconds(lastStopTicks - GetClockStartTicks()) : 0.0;
+
+    // Bucket midpoints can fall just outside the observed range; clamp so p50 <= max etc. read sanely
+    double percentiles[4] = { 0.5, 0.9, 0.99, 0.999 };
+    double* fields[4] = { &p50Time, &p90Time, &p99Time, &p999Time };
+    for (int i = 0; i < 4; ++i) {
+        uint64_t ticks = histogram.Percentile(percentiles[i]);
+        if (count > 0) {
+            ticks = ticks < minTicks ? minTicks : (ticks > maxTicks ? maxTicks : ticks);
+        }
+        *fields[i] = TicksToSeconds(ticks);
+    }
+
+    double cycles = double(perfCounts[PerfCycles]);
+    double instructions = double(perfCounts[PerfInstructions]);
+    ipc = (cycles > 0.0) ? instructions / cycles : 0.0;
+    cacheMissesPerKiloInstruction = (instructions > 0.0) ? 1000.0 * double(perfCounts[PerfCacheMisses]) / instructions : 0.0;
+    branchMissesPerKiloInstruction = (instructions > 0.0) ? 1000.0 * double(perfCounts[PerfBranchMisses]) / instructions : 0.0;
+
+    // Against the raw wall time of the CPU-timed calls only, in case CPU time was switched on mid-run
+    cpuTime = 1e-9 * double(cpuNanoseconds);
+    double cpuTimedWall = (sampledCount > 0) ? TicksToSeconds(sampledTicks) * double(cpuCalls) / double(sampledCount) : 0.0;
+    // The CPU clock reads sit just outside the wall bracket, so part of their own cost can push short
+    // sections past 1
+    cpuUtilization = (cpuTimedWall > 0.0) ? std::min(cpuTime / cpuTimedWall, 1.0) : 0.0;
+
+    itemsPerSecond = (totalTime > 0.0) ? double(items) / totalTime : 0.0;
+    bytesPerSecond = (totalTime > 0.0) ? double(bytes) / totalTime : 0.0;
+
+    for (SlowCall& call: slowestCalls) {
+        call.time = TicksToSeconds(call.ticks);
+        call.startTime = TicksToSeconds(call.startTicks - GetClockStartTicks());
+    }
+}
+
+ThreadSectionTotals const* ThreadStatsReport::Find(int sectionId) const
+{
+    auto it = std::lower_bound(sections.begin(), sections.end(), sectionId,
+                               [](ThreadSectionTotals const& s, int id) { return s.sectionId < id; });
+    return (it != sections.end() && it->sectionId == sectionId) ? &*it : nullptr;
+}
+
+ThreadProfilerData* Profiler::GetThreadData()
+{
+    if (threadCache.instanceId == instanceId) {
+        return threadCache.data;
+    }
+
+    // First section on this thread: register a buffer. This is the only lock on the enter/exit path.
+    std::lock_guard<std::mutex> lock(mutex_);
+    ThreadProfilerData* data = new ThreadProfilerData(std::this_thread::get_id(), nextThreadIndex++);
+    threadData.emplace_back(data);
+    threadCache.data = data;
+    threadCache.instanceId = instanceId;
+    (void)&threadExitHook; // Arms the hook for this thread
+    return data;
+}
+
+std::vector<ThreadProfilerData*> Profiler::AllThreadData()
+{
+    std::vector<ThreadProfilerData*> all;
+    all.reserve(threadData.size() + 1);
+    for (auto& data: threadData) {
+        all.push_back(data.get());
+    }
+    all.push_back(retiredThreads.get());
+    return all;
+}
+
+void Profiler::ReleaseThreadData()
+{
+    RetireThreadData(true);
+}
+
+// Frees the calling thread's buffer, first folding what it recorded into the harvested totals and
+// retiredThreads and keeping its per-section summary, unless keepRecords is false. A thread with
+// sections still active loses those.
+void Profiler::RetireThreadData(bool keepRecords)
+{
+    ThreadProfilerData* data = PeekThreadData();
+    if (!data) {
+        return;
+    }
+    threadCache.instanceId = 0; // From here on the allocation hooks see no buffer, and a later enter registers anew
+    threadCache.data = nullptr;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (keepRecords) {
+        // The owner is this thread, so neither buffer can be mid-update
+        HarvestBuffer(data, 0);
+        HarvestBuffer(data, 1);
+
+        exitedThreadReports.push_back(SummarizeThread(*data, true));
+
+        ThreadProfilerData& retired = *retiredThreads;
+        retired.callTree[0].allocations += data->callTree[0].allocations;
+        retired.callTree[0].allocatedBytes += data->callTree[0].allocatedBytes;
+        retired.callTree[0].frees += data->callTree[0].frees;
+        FoldCallTree(retired, *data, 0, 0);
+        if (retired.spanTotals.size() < data->spanTotals.size()) {
+            retired.spanTotals.resize(data->spanTotals.size(), SpanPathTotals());
+        }
+        for (size_t path = 0; path < data->spanTotals.size(); ++path) {
+            retired.spanTotals[path].count += data->spanTotals[path].count;
+            retired.spanTotals[path].ticks += data->spanTotals[path].ticks;
+        }
+    }
+    if (data->traceChunk && tracing.load()) {
+        traceWriter.SubmitChunk(data->traceChunk); // Keep the tail of this thread's trace
+    }
+    if (!keepRecords && data->threadIndex == nextThreadIndex - 1) {
+        --nextThreadIndex; // Nothing of it was kept, so the index is free to hand out again
+    }
+    for (auto iter = threadData.begin(); iter != threadData.end(); ++iter) {
+        if (iter->get() == data) {
+            threadData.erase(iter);
+            break;
+        }
+    }
+}
+
+ThreadProfilerData* Profiler::PeekThreadData()
+{
+    return (threadCache.instanceId == instanceId) ? threadCache.data : nullptr;
+}
+
+bool Profiler::SetAllocationTracking(bool enabled)
+{
+#ifdef PROFILER_TRACK_ALLOCATIONS
+    allocationTracking.store(enabled, std::memory_order_relaxed);
+    return true;
+#else
+    if (enabled) {
+        std::cerr << "Error: Allocation tracking needs a build with -DPROFILER_TRACK_ALLOCATIONS." << std::endl;
+    }
+    return false;
+#endif
+}
+
+// Threads that never entered a section have no data and are not charged. The call tree is only
+// touched by its own thread until calculateStats, so plain increments are enough.
+void Profiler::RecordAllocation(size_t bytes)
+{
+    if (threadCache.allocationPause) {
+        return;
+    }
+    Profiler* profiler = gProfiler;
+    ThreadProfilerData* data = profiler ? profiler->PeekThreadData() : nullptr;
+    if (data) {
+        CallTreeNode& node = data->callTree[data->currentNode];
+        node.allocations++;
+        node.allocatedBytes += bytes;
+    }
+}
+
+void Profiler::RecordFree()
+{
+    if (threadCache.allocationPause) {
+        return;
+    }
+    Profiler* profiler = gProfiler;
+    ThreadProfilerData* data = profiler ? profiler->PeekThreadData() : nullptr;
+    if (data) {
+        data->callTree[data->currentNode].frees++;
+    }
+}
+
+void Profiler::AddTag(int tagId)
+{
+    ThreadProfilerData* data = GetThreadData();
+    if (data->startTimes.empty()) {
+        std::cerr << "Error: No active section to tag." << std::endl;
+        return;
+    }
+    size_t depth = data->startTimes.size();
+    for (auto tag = data->activeTags.rbegin(); tag != data->activeTags.rend() && tag->depth == depth; ++tag) {
+        if (tag->tagId == tagId) {
+            return; // Counting the call twice under one tag would skew the tag's totals
+        }
+    }
+    data->activeTags.push_back(ActiveTag{depth, tagId});
+}
+
+void Profiler::AddTag(char const* key, char const* value)
+{
+    AddTag(InternTag(key, value));
+}
+
+// Charges a tagged call to each of its tags' groups and drops the tags. Call inside a stats update.
+void Profiler::RecordTaggedCall(ThreadProfilerData* data, int buffer, int sectionId, size_t depth, uint64_t ticksAtStart, uint64_t ticksAtStop, bool sampled)
+{
+    while (!data->activeTags.empty() && data->activeTags.back().depth == depth) {
+        int tagId = data->activeTags.back().tagId;
+        data->activeTags.pop_back();
+
+        uint64_t key = ((uint64_t)sectionId << 32) | (uint32_t)tagId;
+        auto found = data->tagGroupCache.find(key);
+        int tagGroup = (found != data->tagGroupCache.end()) ? found->second : RegisterTagGroup(sectionId, tagId);
+        if (found == data->tagGroupCache.end()) {
+            data->tagGroupCache.emplace(key, tagGroup);
+        }
+
+        ProfilerStats& tagged = data->GetTagStats(buffer, tagGroup);
+        if (sampled) {
+            tagged.RecordCall(ticksAtStart, ticksAtStop);
+        } else {
+            tagged.count++;
+        }
+    }
+}
+
+void Profiler::AddItems(uint64_t count)
+{
+    AddWork(count, 0);
+}
+
+void Profiler::AddBytes(uint64_t bytes)
+{
+    AddWork(0, bytes);
+}
+
+// Goes into the stats buffer like an exit does; a call still running when the buffers flip has its
+// work counted in the window it reported it in
+void Profiler::AddWork(uint64_t items, uint64_t bytes)
+{
+    ThreadProfilerData* data = GetThreadData();
+    if (data->startTimes.empty()) {
+        std::cerr << "Error: No active section to add work to." << std::endl;
+        return;
+    }
+    int buffer = data->BeginStatsUpdate();
+    ProfilerStats& statsEntry = data->GetStats(buffer, data->startTimes.back().sectionId);
+    statsEntry.items += items;
+    statsEntry.bytes += bytes;
+    data->EndStatsUpdate();
+}
+
+int Profiler::GetSectionId(char const* sectionName)
+{
+    return RegisterSection(sectionName, nullptr, nullptr, 0);
+}
+
+ProfilerScopeObject::ProfilerScopeObject(char const* sectionName){
+
+    sectionId = Profiler::GetInstance()->GetSectionId(sectionName);
+    Profiler::GetInstance()->EnterSection(sectionId);
+
+}
+
+ProfilerScopeObject::ProfilerScopeObject(ProfilerCallSite const& callSite):sectionId(callSite.sectionId){
+
+    Profiler::GetInstance()->EnterSection(sectionId);
+
+}
+
+ProfilerScopeObject::~ProfilerScopeObject(){
+
+    Profiler::GetInstance()->ExitSection(sectionId);
+
+}
+void Profiler::EnterSection(int sectionId)
+{
+    ThreadProfilerData* data = GetThreadData();
+
+    int node = data->GetChildNode(data->currentNode, sectionId);
+    data->currentNode = node;
+
+    SectionSampler& sampler = data->GetSampler(sectionId);
+    if (sampler.mode != ProfilerSamplingPolicy::EveryCall && !sampler.Sample()) {
+        data->startTimes.emplace_back(sectionId, 0, node, false, false, false); // Keep nesting, skip the clock
+        return;
+    }
+
+    // Counters and the CPU clock are read outside the timed interval, so they don't inflate the
+    // section's time (which sampling would then multiply). The CPU clock goes last, nearest the wall clock.
+    bool cpuTimed = cpuTimeEnabled.load(std::memory_order_relaxed) && ReadCpuUsageAtEntry(data);
+    bool counted = perfCountersEnabled.load(std::memory_order_relaxed) && ReadPerfCountersAtEntry(data);
+    if (cpuTimed) {
+        ReadThreadCpuTime(data->cpuStarts.back()); // Known to work on this thread, see ReadCpuUsageAtEntry
+    }
+    uint64_t ticksAtStart = GetCurrentTimeTicks(); 
+    data->startTimes.emplace_back(sectionId, ticksAtStart, node, true, counted, cpuTimed);
+
+}
+
+void Profiler::ExitSection(int sectionId) {
+    ExitSectionAs<PROFILER_POLICY_TRACE>(sectionId);
+}
+
+template <int Policy>
+void Profiler::ExitSectionAs(int sectionId) {
+    ThreadProfilerData* data = GetThreadData();
+    if (data->startTimes.empty()) {
+        std::cerr << "Error: No sections to exit." << std::endl;
+        return; // Early return to avoid accessing an empty vector
+    }
+    TimeRecordStart const& currentSection = data->startTimes.back(); 
+    size_t depth = data->startTimes.size();
+    bool tagged = !data->activeTags.empty() && data->activeTags.back().depth == depth;
+
+    // Check if the exiting section matches the last entered section
+    if (currentSection.sectionId != sectionId) {
+        ReportMismatchedExit(sectionId, currentSection.sectionId);
+    }
+
+    CallTreeNode& node = data->callTree[currentSection.callTreeNode];
+    node.count++;
+    data->currentNode = node.parent;
+
+    if (!currentSection.sampled) {
+        data->startTimes.pop_back(); // Counted, but no time to charge
+        int buffer = data->BeginStatsUpdate();
+        data->GetStats(buffer, sectionId).count++;
+        if (tagged) {
+            RecordTaggedCall(data, buffer, sectionId, depth, 0, 0, false);
+        }
+        data->EndStatsUpdate();
+        return;
+    }
+
+    uint64_t ticksAtStop = GetCurrentTimeTicks();
+    uint64_t ticksAtStart = currentSection.ticksAtStart;
+    uint64_t elapsedTicks = ticksAtStop - ticksAtStart;
+
+    bool cpuTimed = currentSection.cpuTimed;
+    ThreadCpuUsage cpuDeltas;
+    if (cpuTimed) {
+        cpuDeltas = data->cpuStarts.back(); // Never charge garbage, though neither read fails once the entry reads worked
+        ReadThreadCpuTime(cpuDeltas);       // First after the wall clock, mirroring the entry
+    }
+
+    bool counted = currentSection.counted;
+    PerfCounterValues counterDeltas;
+    if (counted) {
+        data->perfCounters.Read(counterDeltas.values);
+        PerfCounterValues const& counterStarts = data->perfStarts.back();
+        for (int kind = 0; kind < PERF_COUNTER_COUNT; ++kind) {
+            counterDeltas.values[kind] -= counterStarts.values[kind];
+        }
+        data->perfStarts.pop_back();
+    }
+    if (cpuTimed) {
+        ThreadCpuUsage const& cpuStart = data->cpuStarts.back();
+        ReadThreadContextSwitches(cpuDeltas);
+        cpuDeltas.cpuNanoseconds -= cpuStart.cpuNanoseconds;
+        cpuDeltas.voluntarySwitches -= cpuStart.voluntarySwitches;
+        cpuDeltas.involuntarySwitches -= cpuStart.involuntarySwitches;
+        data->cpuStarts.pop_back();
+    }
+
+    // Charge the call to its tree node; parents' child totals are rebuilt when merging
+    node.sampledCount++;
+    node.inclusiveTicks += elapsedTicks;
+
+    data->startTimes.pop_back(); // Remove the last section from the stack
+
+    if (Policy == PROFILER_POLICY_TRACE) {
+        ReportSectionTime(data, sectionId, ticksAtStart, ticksAtStop);
+    }
+
+    // Update this thread's active stats buffer; only a harvest, after flipping buffers, reads it
+    int buffer = data->BeginStatsUpdate();
+    ProfilerStats& statsEntry = data->GetStats(buffer, sectionId);
+    statsEntry.RecordCall(ticksAtStart, ticksAtStop);
+    if (elapsedTicks > statsEntry.slowCallThresholdTicks && GetSlowCallCapacity() > 0) {
+        RecordSlowCall(data, statsEntry, sectionId, depth, ticksAtStart, elapsedTicks);
+    }
+    if (tagged) {
+        RecordTaggedCall(data, buffer, sectionId, depth, ticksAtStart, ticksAtStop, true);
+    }
+    if (counted) {
+        for (int kind = 0; kind < PERF_COUNTER_COUNT; ++kind) {
+            statsEntry.perfCounts[kind] += counterDeltas.values[kind];
+        }
+        statsEntry.perfCalls++;
+        statsEntry.perfCounterMask |= data->perfCounters.GetAvailableMask();
+    }
+    if (cpuTimed) {
+        statsEntry.cpuNanoseconds += cpuDeltas.cpuNanoseconds;
+        statsEntry.voluntarySwitches += cpuDeltas.voluntarySwitches;
+        statsEntry.involuntarySwitches += cpuDeltas.involuntarySwitches;
+        statsEntry.cpuCalls++;
+    }
+    data->EndStatsUpdate();
+}
+
+template void Profiler::ExitSectionAs<PROFILER_POLICY_STATS>(int sectionId);
+template void Profiler::ExitSectionAs<PROFILER_POLICY_TRACE>(int sectionId);
+
+ProfilerSpan Profiler::BeginSpan(ProfilerCallSite const& callSite, ProfilerSpan const* parent)
+{
+    return BeginSpanById(callSite.sectionId, parent);
+}
+
+ProfilerSpan Profiler::BeginSpan(char const* sectionName, ProfilerSpan const* parent)
+{
+    return BeginSpanById(RegisterSection(sectionName, nullptr, nullptr, 0), parent);
+}
+
+ProfilerSpan Profiler::BeginSpanById(int sectionId, ProfilerSpan const* parent)
+{
+    ThreadProfilerData* data = GetThreadData();
+    int parentPath = (parent && parent->pathId > 0) ? parent->pathId : GetNodeSpanPath(data, data->currentNode);
+
+    ProfilerSpan span;
+    span.sectionId = sectionId;
+    span.pathId = InternSpanPath(data, parentPath, sectionId, true);
+    span.ticksAtStart = GetCurrentTimeTicks();
+    return span;
+}
+
+void Profiler::EndSpan(ProfilerSpan& span)
+{
+    uint64_t ticksAtStop = GetCurrentTimeTicks();
+    if (span.pathId <= 0) {
+        std::cerr << "Error: Ending a span that was never begun or has already ended." << std::endl;
+        return;
+    }
+    if (ticksAtStop < span.ticksAtStart) {
+        ticksAtStop = span.ticksAtStart; // Clocks of different cores disagreeing by a few ticks
+    }
+
+    ThreadProfilerData* data = GetThreadData();
+    if ((size_t)span.pathId >= data->spanTotals.size()) {
+        data->spanTotals.resize(span.pathId + 1, SpanPathTotals());
+    }
+    SpanPathTotals& totals = data->spanTotals[span.pathId];
+    totals.count++;
+    totals.ticks += ticksAtStop - span.ticksAtStart;
+
+    int buffer = data->BeginStatsUpdate();
+    data->GetStats(buffer, span.sectionId).RecordCall(span.ticksAtStart, ticksAtStop);
+    data->EndStatsUpdate();
+
+    span.pathId = 0;
+}
+
+// Span paths name a position in the call tree independently of any thread's own tree, so a token
+// can carry it across threads. Each thread caches the ids it has seen; only new paths take the lock.
+int Profiler::InternSpanPath(ThreadProfilerData* data, int parentPath, int sectionId, bool async)
+{
+    uint64_t key = ((uint64_t)(uint32_t)parentPath << 33) | ((uint64_t)(uint32_t)sectionId << 1) | (async ? 1u : 0u);
+    auto cached = data->spanPathCache.find(key);
+    if (cached != data->spanPathCache.end()) {
+        return cached->second;
+    }
+
+    std::lock_guard<std::mutex> lock(spanMutex);
+    auto found = spanPathIds.find(key);
+    int path;
+    if (found != spanPathIds.end()) {
+        path = found->second;
+    } else {
+        path = (int)spanPaths.size();
+        spanPaths.emplace_back(sectionId, parentPath);
+        spanPaths.back().async = async;
+        spanPathIds.emplace(key, path);
+    }
+    data->spanPathCache.emplace(key, path);
+    return path;
+}
+
+// Span path of one of the calling thread's own call tree nodes
+int Profiler::GetNodeSpanPath(ThreadProfilerData* data, int node)
+{
+    if (node == 0) {
+        return 0;
+    }
+    if ((size_t)node >= data->nodeSpanPaths.size()) {
+        data->nodeSpanPaths.resize(data->callTree.size(), -1);
+    }
+    if (data->nodeSpanPaths[node] == -1) {
+        CallTreeNode const& n = data->callTree[node];
+        int parentPath = GetNodeSpanPath(data, n.parent);
+        data->nodeSpanPaths[node] = InternSpanPath(data, parentPath, n.sectionId, false);
+    }
+    return data->nodeSpanPaths[node];
+}
+
+void Profiler::EnterSection(ProfilerCallSite const& callSite)
+{
+    EnterSection(callSite.sectionId);
+}
+
+void Profiler::ExitSection(ProfilerCallSite const& callSite)
+{
+    ExitSection(callSite.sectionId);
+}
+
+void Profiler::EnterSection(char const* sectionName)
+{
+    EnterSection(RegisterSection(sectionName, nullptr, nullptr, 0));
+}
+
+void Profiler::ExitSection(const char* sectionName) {
+    ExitSection(RegisterSection(sectionName, nullptr, nullptr, 0));
+}
+
+void Profiler::ExitSection(const char* sectionName, int lineNumber, const char* fileName, const char* functionName) {
+    ExitSection(RegisterSection(sectionName, fileName, functionName, lineNumber));
+}
+
+void Profiler::ReportMismatchedExit(int exitingSectionId, int activeSectionId)
+{
+    std::cerr << "Error: Exiting section " << GetSectionInfo(exitingSectionId).sectionName 
+              << " does not match the last entered section " << GetSectionInfo(activeSectionId).sectionName << "." << std::endl;
+}
+
+
+// Appends the call to the thread's trace chunk. Called after the section is popped, so the
+// stack top is the parent. Never blocks: with no free chunk the event is counted as dropped.
+void Profiler::ReportSectionTime(ThreadProfilerData* data, int sectionId, uint64_t ticksAtStart, uint64_t ticksAtStop)
+{
+    if (!tracing.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    TraceChunk* chunk = data->traceChunk;
+    if (!chunk || chunk->header.eventCount == TRACE_EVENTS_PER_CHUNK) {
+        chunk = traceWriter.ExchangeChunk(chunk, data->threadIndex, data->traceChunkSequence++);
+        data->traceChunk = chunk;
+        if (!chunk) {
+            traceWriter.CountDroppedEvent();
+            return;
+        }
+    }
+
+    TraceEvent& event = chunk->events[chunk->header.eventCount++];
+    event.startTicks = ticksAtStart;
+    event.endTicks = ticksAtStop;
+    event.sectionId = sectionId;
+    event.parentSectionId = data->startTimes.empty() ? -1 : data->startTimes.back().sectionId;
+    event.depth = (uint32_t)data->startTimes.size();
+    event.reserved = 0;
+}
+
+bool Profiler::StartTrace(const char* fileName, size_t chunkCount)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (tracing.load()) {
+        std::cerr << "Error: A trace is already running." << std::endl;
+        return false;
+    }
+    if (!traceWriter.Open(fileName, chunkCount, GetSecondsPerTick(), GetClockStartTicks())) {
+        return false;
+    }
+    for (auto& data: threadData) {
+        data->traceChunk = nullptr; // Chunks from an earlier trace belong to a reset pool
+    }
+    tracing.store(true);
+    return true;
+}
+
+void Profiler::StopTrace()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!tracing.load()) {
+        return;
+    }
+    tracing.store(false);
+
+    // Hand over each thread's partially filled chunk so the tail of the trace is not lost
+    for (auto& data: threadData) {
+        if (data->traceChunk) {
+            traceWriter.SubmitChunk(data->traceChunk);
+            data->traceChunk = nullptr;
+        }
+    }
 
-TimeRecordStart::~TimeRecordStart(){}
-TimeRecordStop:: ~TimeRecordStop(){}
+    std::vector<TraceSectionInfo> sections;
+    int sectionCount = GetSectionCount();
+    for (int id = 0; id < sectionCount; ++id) {
+        ProfilerCallSite section = GetSectionInfo(id);
+        TraceSectionInfo info = { id, section.sectionName, section.fileName, section.functionName, section.lineNumber };
+        sections.push_back(info);
+    }
+    traceWriter.Close(sections, (uint32_t)nextThreadIndex);
 
+    if (traceWriter.GetDroppedEvents() > 0) {
+        std::cerr << "Warning: Trace dropped " << traceWriter.GetDroppedEvents()
+                  << " events because the writer fell behind." << std::endl;
+    }
+}
 
-Profiler:: Profiler()
+// Merges every thread's buffer into stats. Call it once instrumented threads are idle
+// (the exporters below call it for you); it is the only place per-thread data is shared.
+void Profiler::calculateStats()
 {
-    gProfiler = this; 
-    startTimes.reserve(100); 
-    elapsedTimes.reserve(1000000);
+    std::lock_guard<std::mutex> lock(mutex_);
+    HarvestThreadStats();
 
+    // Names and locations come from the registry, which may have learned a location after a thread's first call
+    stats.clear();
+    GrowStats(stats, (int)harvestedStats.size());
+    for (ProfilerStats const& harvested: harvestedStats)
+    {
+        stats[harvested.sectionId].Merge(harvested);
+    }
 
-}
-Profiler* Profiler::GetInstance()
-{
-    if(gProfiler == nullptr)
+    callTree.clear();
+    mergedChildren.clear();
+    callTree.emplace_back(-1, -1);
+    for (ThreadProfilerData* data: AllThreadData())
     {
-        gProfiler = new Profiler(); 
+        callTree[0].allocations += data->callTree[0].allocations; // Allocations outside any section
+        callTree[0].allocatedBytes += data->callTree[0].allocatedBytes;
+        callTree[0].frees += data->callTree[0].frees;
+        MergeCallTree(*data, 0, 0);
     }
+    MergeSpans();
 
-    return gProfiler; 
-}
-Profiler::~Profiler()
-{
-    // for(auto& start: startTimes)
-    // {
-    //     delete start; 
-    // }
-    // for(auto& elapsed: elapsedTimes)
-    // {
-    //     delete elapsed;
-    // }
-    for (auto& stat: stats)
+    // Scale sampled sections up to all calls before anything derives from their totals
+    for (ProfilerStats& stat: stats)
     {
-        delete stat.second; 
+        stat.ExtrapolateSamples();
+        stat.samplingPolicy = GetSamplingPolicy(stat.sectionId).Describe();
+    }
+    for (size_t node = 1; node < callTree.size(); ++node)
+    {
+        CallTreeNode& n = callTree[node];
+        if (n.sampledCount > 0 && n.sampledCount < n.count) {
+            n.inclusiveTicks = (uint64_t)(double(n.inclusiveTicks) * double(n.count) / double(n.sampledCount));
+        }
+    }
+    RebuildChildTicks();
 
+    if (compensateOverhead)
+    {
+        SubtractOverhead();
     }
-}
 
-ProfilerScopeObject::ProfilerScopeObject(char const* sectionName){
+    // Self time and allocations per section are the sums over every path it appears on
+    for (size_t node = 1; node < callTree.size(); ++node)
+    {
+        CallTreeNode const& n = callTree[node];
+        ProfilerStats& stat = stats[n.sectionId];
+        stat.exclusiveTicks += n.ExclusiveTicks();
+        stat.allocations += n.allocations;
+        stat.allocatedBytes += n.allocatedBytes;
+        stat.frees += n.frees;
+    }
+
+    for (ProfilerStats& stat: stats)
+    {
+        stat.UpdateTimes();
+        stat.parentSection = GetParentSectionName(stat.sectionId);
+    }
 
-    Profiler::GetInstance()->EnterSection(sectionName);
+    tagStats = harvestedTagStats;
+    for (ProfilerStats& stat: tagStats)
+    {
+        stat.ExtrapolateSamples();
+        stat.UpdateTimes();
+    }
 
+    threadReports = exitedThreadReports;
+    for (auto& data: threadData)
+    {
+        threadReports.push_back(SummarizeThread(*data, false));
+    }
+    std::sort(threadReports.begin(), threadReports.end(),
+              [](ThreadStatsReport const& a, ThreadStatsReport const& b) { return a.threadIndex < b.threadIndex; });
 }
 
-ProfilerScopeObject::~ProfilerScopeObject(){
+// Swaps every thread's stats buffer and folds the retired one into the harvested totals and the
+// current window. Threads keep recording into the other buffer meanwhile; the only wait is for a
+// thread that was halfway through one stats update when the buffers flipped. Call with mutex_ held.
+void Profiler::HarvestThreadStats()
+{
+    int sectionCount = GetSectionCount();
+    GrowStats(harvestedStats, sectionCount);
+    GrowStats(windowStats, sectionCount);
+
+    for (auto& data: threadData)
+    {
+        int retired = data->activeStats.load(std::memory_order_relaxed);
+        data->activeStats.store(1 - retired, std::memory_order_seq_cst);
+        while (data->recordingStats.load(std::memory_order_seq_cst)) {
+            std::this_thread::yield();
+        }
+        HarvestBuffer(data.get(), retired);
+    }
+}
 
-    Profiler::GetInstance()->ExitSection(sectionName);
+// Folds one of a thread's stats buffers into the harvested totals, the current window and the
+// thread's own totals, and clears it. Call with mutex_ held and the owner not writing to it.
+void Profiler::HarvestBuffer(ThreadProfilerData* data, int buffer)
+{
+    for (ProfilerStats& threadStat: data->stats[buffer])
+    {
+        if (threadStat.count == 0 && threadStat.items == 0 && threadStat.bytes == 0) {
+            continue; // Work can arrive before the first exit of a long call
+        }
+        if (threadStat.sectionId >= (int)harvestedStats.size()) {
+            // Registered after the caller last grew them
+            GrowStats(harvestedStats, GetSectionCount());
+            GrowStats(windowStats, GetSectionCount());
+        }
+        harvestedStats[threadStat.sectionId].Merge(threadStat);
+        windowStats[threadStat.sectionId].Merge(threadStat);
+        GrowStats(data->harvestedStats, (int)harvestedStats.size());
+        data->harvestedStats[threadStat.sectionId].Merge(threadStat);
+        threadStat.Reset();
+    }
 
+    // Tag stats carry their section's id, so they are matched up by tag group, i.e. by position
+    std::vector<ProfilerStats>& threadTagStats = data->tagStats[buffer];
+    for (size_t tagGroup = 0; tagGroup < threadTagStats.size(); ++tagGroup)
+    {
+        if (threadTagStats[tagGroup].count == 0) {
+            continue;
+        }
+        GrowTagStats(harvestedTagStats, GetTagGroupCount());
+        harvestedTagStats[tagGroup].Merge(threadTagStats[tagGroup]);
+        threadTagStats[tagGroup].Reset();
+    }
 }
-void Profiler::EnterSection(char const* sectionName)
+
+ProfilerSnapshot Profiler::TakeSnapshot()
 {
-    std::lock_guard<std::mutex> lock(mutex_); // Lock the mutex for thread safety
-        
-    activeSections.push(sectionName);
+    std::lock_guard<std::mutex> lock(mutex_);
+    HarvestThreadStats();
+
+    ProfilerSnapshot snapshot;
+    snapshot.index = snapshotCount++;
+    snapshot.startTicks = windowStartTicks;
+    snapshot.endTicks = GetCurrentTimeTicks();
+    snapshot.startTime = TicksToSeconds(snapshot.startTicks - GetClockStartTicks());
+    snapshot.endTime = TicksToSeconds(snapshot.endTicks - GetClockStartTicks());
+    windowStartTicks = snapshot.endTicks;
 
-    double secondsAtStart = GetCurrentTimeSeconds(); 
-    startTimes.emplace_back(sectionName, secondsAtStart);
+    for (ProfilerStats& window: windowStats)
+    {
+        if (window.count == 0) {
+            continue;
+        }
+        ProfilerCallSite section = GetSectionInfo(window.sectionId);
+        snapshot.stats.emplace_back(section.sectionName, section.fileName, section.functionName, section.lineNumber, window.sectionId);
+        ProfilerStats& stat = snapshot.stats.back();
+        stat.Merge(window);
+        stat.ExtrapolateSamples();
+        stat.samplingPolicy = GetSamplingPolicy(stat.sectionId).Describe();
+        stat.UpdateTimes();
+        window.Reset();
+    }
 
+    snapshots.push_back(snapshot);
+    while (snapshots.size() > snapshotHistory) {
+        snapshots.pop_front();
+    }
+    return snapshot;
 }
 
-void Profiler::ExitSection(const char* sectionName) {
-    std::lock_guard<std::mutex> lock(mutex_); // Lock for thread safety
+void Profiler::SetSnapshotHistory(size_t windowCount)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    snapshotHistory = windowCount;
+    while (snapshots.size() > snapshotHistory) {
+        snapshots.pop_front();
+    }
+}
 
-    double secondsAtStop = GetCurrentTimeSeconds(); // Get the current time
+std::vector<ProfilerSnapshot> Profiler::GetSnapshots()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return std::vector<ProfilerSnapshot>(snapshots.begin(), snapshots.end());
+}
 
-    if (startTimes.empty()) {
-        std::cerr << "Error: No sections to exit." << std::endl;
-        return; // Prevent accessing an empty vector
+// Takes a snapshot every intervalSeconds on a background thread until StopSnapshotTimer
+bool Profiler::StartSnapshotTimer(double intervalSeconds)
+{
+    if (snapshotThread.joinable()) {
+        std::cerr << "Error: The snapshot timer is already running." << std::endl;
+        return false;
     }
+    if (intervalSeconds <= 0.0) {
+        std::cerr << "Error: Snapshot interval must be positive." << std::endl;
+        return false;
+    }
+    snapshotStopping = false;
+    snapshotThread = std::thread(&Profiler::SnapshotLoop, this, intervalSeconds);
+    return true;
+}
 
-    TimeRecordStart const& currentSection = startTimes.back(); // Get the last section started
-    double elapsedTime = secondsAtStop - currentSection.secondsAtStart; // Calculate elapsed time
-
-    // Update the section's statistics
-    ReportSectionTime(sectionName, elapsedTime); 
-    startTimes.pop_back(); // Remove the last section from the stack
+void Profiler::StopSnapshotTimer()
+{
+    if (!snapshotThread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(snapshotMutex);
+        snapshotStopping = true;
+    }
+    snapshotWake.notify_one();
+    snapshotThread.join();
+}
 
-    // Check active sections to ensure proper matching
-    if (!activeSections.empty()) {
-        const char* lastSectionName = activeSections.top().c_str(); // Get the last entered section name
+void Profiler::SnapshotLoop(double intervalSeconds)
+{
+    std::chrono::duration<double> interval(intervalSeconds);
+    std::unique_lock<std::mutex> lock(snapshotMutex);
+    while (!snapshotWake.wait_for(lock, interval, [this]() { return snapshotStopping; })) {
+        lock.unlock();
+        TakeSnapshot();
+        lock.lock();
+    }
+}
 
-        // Check if the exiting section matches the last entered section
-        if (strcmp(lastSectionName, sectionName) != 0) {
-            std::cerr << "Error: Exiting section " << sectionName 
-                      << " does not match the last entered section " << lastSectionName << "." << std::endl;
-        } else {
-            activeSections.pop(); // Remove the matched section from the stack
+// Opens this thread's counters on first use and pushes the entry reading. A thread whose counters
+// fail to open is marked and never retries; the process warns once.
+bool Profiler::ReadPerfCountersAtEntry(ThreadProfilerData* data)
+{
+    if (data->perfState == 0) {
+        data->perfState = data->perfCounters.Open() ? 1 : -1;
+        static std::atomic<bool> warned(false);
+        if (data->perfState < 0 && !warned.exchange(true)) {
+            std::cerr << "Warning: Hardware performance counters are unavailable (" << data->perfCounters.GetError()
+                      << "); sections are timed without them." << std::endl;
         }
     }
+    if (data->perfState < 0) {
+        return false;
+    }
+    data->perfStarts.emplace_back();
+    data->perfCounters.Read(data->perfStarts.back().values);
+    return true;
+}
 
-    // Update statistics for the section
-    auto& statsEntry = stats[sectionName]; // Get or create stats for this section
-    if (statsEntry) {
-        statsEntry->count++;
-        statsEntry->totalTime += elapsedTime;
+// Slow path of an exit whose call is among the section's slowest on this thread so far. The section
+// has already been popped, so the remaining active sections are its ancestors.
+void Profiler::RecordSlowCall(ThreadProfilerData* data, ProfilerStats& statsEntry, int sectionId, size_t depth, uint64_t ticksAtStart, uint64_t elapsedTicks)
+{
+    AllocationPause pause; // The stack and tag copies are the profiler's, not the exiting section's parent's
+    SlowCall& call = statsEntry.AddSlowCall(elapsedTicks);
+    call.startTicks = ticksAtStart;
+    call.threadIndex = data->threadIndex;
+    call.osThreadId = data->osThreadId;
+    call.stack.clear();
+    for (TimeRecordStart const& active: data->startTimes) {
+        call.stack.push_back(active.sectionId);
+    }
+    call.stack.push_back(sectionId);
+    call.tags.clear();
+    for (auto tag = data->activeTags.rbegin(); tag != data->activeTags.rend() && tag->depth == depth; ++tag) {
+        call.tags.push_back(tag->tagId);
+    }
+}
 
-        // Update min and max
-        if (elapsedTime < statsEntry->minTime) {
-            statsEntry->minTime = elapsedTime; // Update minimum time
-        }
-        if (elapsedTime > statsEntry->maxTime) {
-            statsEntry->maxTime = elapsedTime; // Update maximum time
+// Pushes the entry reading of the thread's context switches, with the same one-time warning as the
+// counters. The CPU clock is read by the caller once the wall clock has started; the first call on
+// each thread checks that it works, so later reads need no error handling.
+bool Profiler::ReadCpuUsageAtEntry(ThreadProfilerData* data)
+{
+    if (data->cpuState < 0) {
+        return false;
+    }
+    data->cpuStarts.emplace_back();
+    bool available = (data->cpuState > 0 || ReadThreadCpuTime(data->cpuStarts.back())) &&
+                     ReadThreadContextSwitches(data->cpuStarts.back());
+    if (!available) {
+        data->cpuStarts.pop_back();
+        data->cpuState = -1;
+        static std::atomic<bool> warned(false);
+        if (!warned.exchange(true)) {
+            std::cerr << "Warning: Per-thread CPU time is unavailable on this system; sections are timed without it." << std::endl;
         }
+        return false;
+    }
+    data->cpuState = 1;
+    return true;
+}
 
-        statsEntry->avgTime = statsEntry->totalTime / statsEntry->count; // Update average
-    } else {
-        // If stats don't exist, create a new entry
-        statsEntry = new ProfilerStats(sectionName, __FILE__, __FUNCTION__, __LINE__);
-        statsEntry->count = 1;
-        statsEntry->totalTime = elapsedTime;
-        statsEntry->minTime = elapsedTime; // Set min to the first elapsed time
-        statsEntry->maxTime = elapsedTime; // Set max to the first elapsed time
-        statsEntry->avgTime = elapsedTime; // Set average to the first elapsed time
+bool Profiler::StartLiveStats(const char* name, double intervalSeconds, size_t sectionCapacity)
+{
+    if (liveStats.IsOpen()) {
+        std::cerr << "Error: Live stats are already being published." << std::endl;
+        return false;
     }
+    std::string regionName = name ? name : LiveStatsPublisher::DefaultName();
+    return liveStats.Open(regionName.c_str(), sectionCapacity, intervalSeconds, [this]() { PublishLiveStats(); });
 }
 
-void Profiler::ExitSection(const char* sectionName, int lineNumber, const char* fileName, const char* functionName) {
-    double secondsAtStop = GetCurrentTimeSeconds();
-    if (startTimes.empty()) {
-        std::cerr << "Error: No sections to exit." << std::endl;
-        return; // Early return to avoid accessing an empty vector
+void Profiler::StopLiveStats()
+{
+    liveStats.Close();
+}
+
+// Runs on the publisher's thread. Totals are as measured; overhead compensation and exclusive
+// time need the call tree, which is only merged once threads are idle.
+void Profiler::PublishLiveStats()
+{
+    std::vector<ProfilerStats> current;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        HarvestThreadStats();
+        current = harvestedStats;
     }
-    TimeRecordStart const& currentSection = startTimes.back(); 
+    for (ProfilerStats& stat: current)
+    {
+        stat.ExtrapolateSamples();
+        stat.UpdateTimes();
+    }
+    liveStats.Publish(current, TicksToSeconds(GetCurrentTimeTicks() - GetClockStartTicks()));
+}
 
-    double elapsedTime = secondsAtStop - currentSection.secondsAtStart;
-    startTimes.pop_back(); // Remove the last section from the stack
+void Profiler::CalibrateOverhead()
+{
+    static ProfilerCallSite const calibrationSite("Profiler Overhead Calibration", __FILE__, __FUNCTION__, __LINE__);
+    const int iterations = 20000;
+    const int rounds = 5;
 
-       if (!activeSections.empty()) {
-        const char* lastSectionName = activeSections.top().c_str(); // Get the last entered section name
+    // Run on a scratch thread through the public API, so the numbers include the thread-local
+    // lookup, then throw that thread's records away. Keep the fastest round to skip interrupts.
+    ThreadProfilerData* calibrationData = nullptr;
+    uint64_t bestPairTicks = UINT64_MAX;
+    uint64_t bestInnerTicks = UINT64_MAX;
+    std::thread calibration([&]() {
+        calibrationData = GetThreadData();
+        // Inner time comes from the call tree, which snapshots never swap out from under us
+        int node = calibrationData->GetChildNode(0, calibrationSite.sectionId);
+        for (int round = 0; round < rounds; ++round) {
+            uint64_t innerBefore = calibrationData->callTree[node].inclusiveTicks;
+            uint64_t start = GetCurrentTimeTicks();
+            for (int i = 0; i < iterations; ++i) {
+                EnterSection(calibrationSite);
+                ExitSection(calibrationSite);
+            }
+            uint64_t stop = GetCurrentTimeTicks();
+            uint64_t innerTicks = calibrationData->callTree[node].inclusiveTicks - innerBefore;
 
-        // Check if the exiting section matches the last entered section
-        if (strcmp(lastSectionName, sectionName) != 0) {
-            std::cerr << "Error: Exiting section " << sectionName 
-                      << " does not match the last entered section " << lastSectionName << "." << std::endl;
+            if ((stop - start) / iterations < bestPairTicks) {
+                bestPairTicks = (stop - start) / iterations;
+            }
+            if (innerTicks / iterations < bestInnerTicks) {
+                bestInnerTicks = innerTicks / iterations;
+            }
         }
+        RetireThreadData(false);
+    });
+    calibration.join();
+
+    overheadPairTicks = bestPairTicks;
+    overheadInnerTicks = bestInnerTicks < bestPairTicks ? bestInnerTicks : bestPairTicks;
+}
+
+double Profiler::GetEnterExitOverheadSeconds() const
+{
+    return TicksToSeconds(overheadPairTicks);
+}
 
-        activeSections.pop(); // Remove the last section from the stack
+double Profiler::GetEmptySectionOverheadSeconds() const
+{
+    return TicksToSeconds(overheadInnerTicks);
+}
+
+// Removes the calibrated profiler cost from the merged call tree and section totals. A node's
+// inclusive time holds its own empty-section cost per call plus a full pair per nested call.
+// Per-call min/max/percentiles are left as measured.
+void Profiler::SubtractOverhead()
+{
+    // Children are always appended after their parent, so a reverse walk sees every child first
+    std::vector<uint64_t> nestedCalls(callTree.size(), 0);
+    for (size_t node = callTree.size() - 1; node >= 1; --node)
+    {
+        if (!callTree[node].async) {
+            nestedCalls[callTree[node].parent] += nestedCalls[node] + callTree[node].count;
+        }
     }
-    // Update stats
-    auto& statsEntry = stats[sectionName]; // Get or create stats for this section
-    if (statsEntry) {
-        statsEntry->count++;
-        statsEntry->totalTime += elapsedTime;
 
-        // Update min and max
-        if (elapsedTime < statsEntry->minTime) {
-            statsEntry->minTime = elapsedTime; // Update minimum time
+    for (size_t node = 1; node < callTree.size(); ++node)
+    {
+        CallTreeNode& n = callTree[node];
+        if (n.async) {
+            continue; // Spans run on their own schedule and are reported as measured
+        }
+        uint64_t overhead = (uint64_t)n.count * overheadInnerTicks + nestedCalls[node] * overheadPairTicks;
+        if (overhead > n.inclusiveTicks) {
+            overhead = n.inclusiveTicks;
         }
-        if (elapsedTime > statsEntry->maxTime) {
-            statsEntry->maxTime = elapsedTime; // Update maximum time
+        n.inclusiveTicks -= overhead;
+
+        ProfilerStats& stat = stats[n.sectionId];
+        stat.totalTicks -= (overhead < stat.totalTicks) ? overhead : stat.totalTicks;
+    }
+
+    RebuildChildTicks();
+}
+
+// Child time is derived from the (extrapolated, compensated) children rather than accumulated on
+// the hot path, so a timed parent with untimed children still gets a sensible exclusive time
+void Profiler::RebuildChildTicks()
+{
+    for (CallTreeNode& n: callTree)
+    {
+        n.childTicks = 0;
+    }
+    for (size_t node = 1; node < callTree.size(); ++node)
+    {
+        if (!callTree[node].async) {
+            callTree[callTree[node].parent].childTicks += callTree[node].inclusiveTicks;
         }
-        
-        statsEntry->avgTime = statsEntry->totalTime / statsEntry->count; // Update average
+    }
+}
+
+// Adds threadNode's children (and their subtrees) under mergedNode, matching paths by section id
+void Profiler::MergeCallTree(ThreadProfilerData const& data, int threadNode, int mergedNode)
+{
+    for (int child = data.callTree[threadNode].firstChild; child != -1; child = data.callTree[child].nextSibling)
+    {
+        CallTreeNode const& source = data.callTree[child];
+        int merged = GetMergedChild(mergedNode, source.sectionId, false);
+
+        callTree[merged].count += source.count;
+        callTree[merged].sampledCount += source.sampledCount;
+        callTree[merged].inclusiveTicks += source.inclusiveTicks;
+        callTree[merged].childTicks += source.childTicks;
+        callTree[merged].allocations += source.allocations;
+        callTree[merged].allocatedBytes += source.allocatedBytes;
+        callTree[merged].frees += source.frees;
+        MergeCallTree(data, child, merged);
+    }
+}
+
+// Finds or appends the merged child of parent for sectionId; spans and sections stay separate nodes
+int Profiler::GetMergedChild(int parent, int sectionId, bool async)
+{
+    uint64_t key = ((uint64_t)parent << 32) | ((uint32_t)sectionId << 1) | (async ? 1u : 0u);
+    auto found = mergedChildren.find(key);
+    if (found != mergedChildren.end()) {
+        return found->second;
+    }
+    int child = (int)callTree.size();
+    callTree.emplace_back(sectionId, parent);
+    callTree[child].async = async;
+    if (callTree[parent].firstChild == -1) {
+        callTree[parent].firstChild = child;
     } else {
-        // If stats don't exist, create a new entry
-        statsEntry = new ProfilerStats(sectionName, fileName, functionName, lineNumber);
-        statsEntry->count = 1;
-        statsEntry->totalTime = elapsedTime;
-        statsEntry->minTime = elapsedTime; // Set min to the first elapsed time
-        statsEntry->maxTime = elapsedTime; // Set max to the first elapsed time
-        statsEntry->avgTime = elapsedTime; // Set average to the first elapsed time
+        callTree[callTree[parent].lastChild].nextSibling = child;
     }
+    callTree[parent].lastChild = child;
+    mergedChildren.emplace(key, child);
+    return child;
 }
 
+// Adds every thread's ended spans to the merged tree under their recorded parents
+void Profiler::MergeSpans()
+{
+    std::lock_guard<std::mutex> lock(spanMutex);
+    std::vector<int> mergedNodes(spanPaths.size(), -1);
+    mergedNodes[0] = 0;
+    for (ThreadProfilerData* data: AllThreadData())
+    {
+        for (size_t path = 1; path < data->spanTotals.size(); ++path)
+        {
+            SpanPathTotals const& totals = data->spanTotals[path];
+            if (totals.count == 0) {
+                continue;
+            }
+            CallTreeNode& node = callTree[ResolveSpanPath((int)path, mergedNodes)];
+            node.count += (int)totals.count;
+            node.sampledCount += (int)totals.count;
+            node.inclusiveTicks += totals.ticks;
+        }
+    }
+}
 
-void Profiler::ReportSectionTime(char const* sectionName, double elapsedTime)
+// Merged node for a span path, creating the chain of nodes above it on first use. Call with spanMutex held.
+int Profiler::ResolveSpanPath(int path, std::vector<int>& mergedNodes)
 {
-    elapsedTimes.emplace_back(sectionName, elapsedTime, __LINE__, __FILE__, __FUNCTION__);
+    if (mergedNodes[path] == -1) {
+        CallTreeNode const& entry = spanPaths[path];
+        int parent = ResolveSpanPath(entry.parent, mergedNodes);
+        mergedNodes[path] = GetMergedChild(parent, entry.sectionId, entry.async);
+    }
+    return mergedNodes[path];
 }
 
-void Profiler::ReportSectionTime(char const* sectionName, double elapsedTime, int lineNumber, const char* fileName, const char* functionName)
+const char* Profiler::GetParentSectionName(int sectionId)
 {
-    elapsedTimes.emplace_back(sectionName, elapsedTime, lineNumber, fileName, functionName );
+    // A section can sit under several parents; report the one it spends the most time under
+    int bestParent = -1;
+    uint64_t bestTicks = 0;
+    for (size_t node = 1; node < callTree.size(); ++node)
+    {
+        if (callTree[node].sectionId == sectionId && (bestParent == -1 || callTree[node].inclusiveTicks > bestTicks))
+        {
+            bestParent = callTree[node].parent;
+            bestTicks = callTree[node].inclusiveTicks;
+        }
+    }
+    return bestParent > 0 ? stats[callTree[bestParent].sectionId].sectionName : nullptr;
 }
 
 void Profiler::printStats() {
-    for (auto iter = stats.begin(); iter != stats.end(); ++iter) {
-        const char* sectionName = iter->first;
-        ProfilerStats* stats = iter->second;
+    calculateStats();
+
+    printf("Clock source: %s (%.3f MHz)\n", GetClockSourceName(), 1e-6 / GetSecondsPerTick());
+    printf("Profiler overhead: %.01fns per enter/exit pair, %.01fns inside an empty section (%s)\n",
+           1e9 * GetEnterExitOverheadSeconds(), 1e9 * GetEmptySectionOverheadSeconds(),
+           compensateOverhead ? "subtracted from inclusive times" : "not subtracted");
+
+    for (auto iter = this->stats.begin(); iter != this->stats.end(); ++iter) {
+        ProfilerStats* stats = &*iter;
+        const char* sectionName = stats->sectionName;
+        if (stats->count == 0) {
+            continue; // Registered but never exited
+        }
 
         // Calculate average time if count is not zero to avoid division by zero
         double averageSeconds = (stats->count > 0) ? (stats->totalTime / stats->count) : 0.0;
 
-        printf("Section \"%s\" had %i calls for %.06fms; avg=%.06fms, min=%.06fms, max=%.06fms\n",
+        printf("Section \"%s\" had %i calls for %.06fms (self %.06fms); avg=%.06fms, stddev=%.06fms, min=%.06fms, max=%.06fms; "
+               "p50=%.06fms, p90=%.06fms, p99=%.06fms, p99.9=%.06fms\n",
                sectionName, stats->count,
                1000.0 * stats->totalTime,  // Convert total time to milliseconds
+               1000.0 * stats->exclusiveTime,
                1000.0 * averageSeconds,
+               1000.0 * stats->stdDevTime,
                1000.0 * stats->minTime,
-               1000.0 * stats->maxTime);
+               1000.0 * stats->maxTime,
+               1000.0 * stats->p50Time,
+               1000.0 * stats->p90Time,
+               1000.0 * stats->p99Time,
+               1000.0 * stats->p999Time);
+        if (stats->sampledCount < stats->count) {
+            printf("    sampled %s: %i of %i calls timed, totals extrapolated\n",
+                   stats->samplingPolicy.c_str(), stats->sampledCount, stats->count);
+        }
+        if (stats->allocations > 0 || stats->frees > 0) {
+            printf("    allocations: %llu (%llu bytes), frees: %llu\n", (unsigned long long)stats->allocations,
+                   (unsigned long long)stats->allocatedBytes, (unsigned long long)stats->frees);
+        }
+        if (stats->perfCalls > 0) {
+            printf("    counters over %i calls: IPC=%.02f, cache misses/1k instr=%.02f, branch misses/1k instr=%.02f\n",
+                   stats->perfCalls, stats->ipc, stats->cacheMissesPerKiloInstruction, stats->branchMissesPerKiloInstruction);
+        }
+        if (stats->cpuCalls > 0) {
+            printf("    cpu over %i calls: %.06fms (%.01f%% of wall), context switches: %llu voluntary, %llu involuntary\n",
+                   stats->cpuCalls, 1000.0 * stats->cpuTime, 100.0 * stats->cpuUtilization,
+                   (unsigned long long)stats->voluntarySwitches, (unsigned long long)stats->involuntarySwitches);
+        }
+        if (!stats->slowestCalls.empty()) {
+            SlowCall const& slowest = stats->slowestCalls.front();
+            printf("    slowest: %.06fms at %.03fs on thread %i (tid %llu), in ", 1000.0 * slowest.time, slowest.startTime,
+                   slowest.threadIndex, (unsigned long long)slowest.osThreadId);
+            for (size_t level = 0; level < slowest.stack.size(); ++level) {
+                printf("%s%s", level == 0 ? "" : " > ", GetSectionInfo(slowest.stack[level]).sectionName);
+            }
+            for (int tagId: slowest.tags) {
+                printf(" [%s=%s]", GetTagKey(tagId), GetTagValue(tagId));
+            }
+            printf("\n");
+        }
+        if (stats->items > 0 || stats->bytes > 0) {
+            printf("    throughput: %llu items (%.03f M items/s), %llu bytes (%.03f GB/s)\n", (unsigned long long)stats->items,
+                   1e-6 * stats->itemsPerSecond, (unsigned long long)stats->bytes, 1e-9 * stats->bytesPerSecond);
+        }
+        printThreadBreakdown(stats->sectionId);
+    }
+
+    if (allocationTracking.load(std::memory_order_relaxed) && !callTree.empty()) {
+        printf("Allocations outside any section: %llu (%llu bytes), frees: %llu\n", (unsigned long long)callTree[0].allocations,
+               (unsigned long long)callTree[0].allocatedBytes, (unsigned long long)callTree[0].frees);
+    }
+
+    printTags();
+    printCallTree();
+}
+
+// Prints the per-tag stats from the last calculateStats, one block per key=value
+void Profiler::printTags() {
+    std::vector<int> order = TagGroupsByTag(tagStats);
+    int currentTag = -1;
+    for (int tagGroup: order) {
+        ProfilerStats const& stat = tagStats[tagGroup];
+        int tagId = GetTagGroup(tagGroup).tagId;
+        if (tagId != currentTag) {
+            printf("Tag %s=%s:\n", GetTagKey(tagId), GetTagValue(tagId));
+            currentTag = tagId;
+        }
+        printf("    \"%s\": %i calls for %.06fms; avg=%.06fms, max=%.06fms, p99=%.06fms\n",
+               stat.sectionName, stat.count, 1000.0 * stat.totalTime, 1000.0 * stat.avgTime,
+               1000.0 * stat.maxTime, 1000.0 * stat.p99Time);
+    }
+}
+
+// Writes the top-level "tags" member: one object per key=value with the sections it was seen on
+void Profiler::writeTagsJSON(std::ofstream& file) {
+    std::vector<int> order = TagGroupsByTag(tagStats);
+    file << "  \"tags\": [";
+    int currentTag = -1;
+    for (int tagGroup: order) {
+        ProfilerStats const& stat = tagStats[tagGroup];
+        int tagId = GetTagGroup(tagGroup).tagId;
+        if (tagId != currentTag) {
+            file << (currentTag == -1 ? "\n" : "\n      ]\n    },\n")
+                 << "    {\n"
+                 << "      \"key\": \"" << EscapeJSON(GetTagKey(tagId)) << "\",\n"
+                 << "      \"value\": \"" << EscapeJSON(GetTagValue(tagId)) << "\",\n"
+                 << "      \"sections\": [\n";
+            currentTag = tagId;
+        } else {
+            file << ",\n";
+        }
+        file << "        { \"sectionName\": \"" << EscapeJSON(stat.sectionName) << "\""
+             << ", \"count\": " << stat.count
+             << ", \"totalTime\": " << (1000.0 * stat.totalTime)
+             << ", \"averageTime\": " << (1000.0 * stat.avgTime)
+             << ", \"maxTime\": " << (1000.0 * stat.maxTime)
+             << ", \"p99Time\": " << (1000.0 * stat.p99Time) << " }";
+    }
+    file << (currentTag == -1 ? "],\n" : "\n      ]\n    }\n  ],\n");
+}
+
+// Prints the merged call tree from the last calculateStats, one indented line per path
+void Profiler::printCallTree() {
+    printf("Call tree:\n");
+    for (int child = callTree.empty() ? -1 : callTree[0].firstChild; child != -1; child = callTree[child].nextSibling) {
+        printCallTreeNode(child, 1);
+    }
+}
+
+void Profiler::printCallTreeNode(int node, int depth) {
+    CallTreeNode const& n = callTree[node];
+    printf("%*s%s%s: %i calls, inclusive=%.06fms, exclusive=%.06fms\n",
+           2 * depth, "", stats[n.sectionId].sectionName, n.async ? " (async)" : "", n.count,
+           1000.0 * TicksToSeconds(n.inclusiveTicks),
+           1000.0 * TicksToSeconds(n.ExclusiveTicks()));
+    for (int child = n.firstChild; child != -1; child = callTree[child].nextSibling) {
+        printCallTreeNode(child, depth + 1);
+    }
+}
+
+// Writes the "sections" array shared by the JSON and CSV exporters
+void Profiler::writeSectionsJSON(std::ofstream& file) {
+    file << "  \"sections\": [\n";
+
+    // Iterate the flat stats array, skipping sections that were registered but never exited
+    bool firstSection = true;
+    for (auto iter = stats.begin(); iter != stats.end(); ++iter) {
+        ProfilerStats* s = &*iter;
+        if (s->count == 0) {
+            continue;
+        }
+        if (!firstSection) {
+            file << ",\n"; // Separate from the previous section; no trailing comma after the last
+        }
+        firstSection = false;
+        double average = (s->count > 0) ? (s->totalTime / s->count) : 0.0;
+
+        // Write the JSON object for this section
+        file << "    {\n"
+             << "      \"sectionName\": \"" << EscapeJSON(s->sectionName) << "\",\n"
+             << "      \"count\": " << s->count << ",\n"
+             << "      \"sampledCount\": " << s->sampledCount << ",\n"
+             << "      \"sampledTime\": " << (1000.0 * TicksToSeconds(s->sampledTicks)) << ",\n" // Raw, like stdDevTime
+             << "      \"sampled\": " << (s->sampledCount < s->count ? "true" : "false") << ",\n"
+             << "      \"samplingPolicy\": \"" << s->samplingPolicy << "\",\n"
+             << "      \"totalTime\": " << (1000.0 * s->totalTime) << ",\n" // Convert to milliseconds
+             << "      \"exclusiveTime\": " << (1000.0 * s->exclusiveTime) << ",\n"
+             << "      \"minTime\": " << (1000.0 * s->minTime) << ",\n"
+             << "      \"maxTime\": " << (1000.0 * s->maxTime) << ",\n"
+             << "      \"averageTime\": " << (1000.0 * average) << ",\n"
+             << "      \"stdDevTime\": " << (1000.0 * s->stdDevTime) << ",\n"
+             << "      \"p50Time\": " << (1000.0 * s->p50Time) << ",\n"
+             << "      \"p90Time\": " << (1000.0 * s->p90Time) << ",\n"
+             << "      \"p99Time\": " << (1000.0 * s->p99Time) << ",\n"
+             << "      \"p999Time\": " << (1000.0 * s->p999Time) << ",\n"
+             << "      \"startTime\": " << (1000.0 * s->startTime) << ",\n"
+             << "      \"endTime\": " << (1000.0 * s->endTime) << ",\n"
+             << "      \"parentSection\": ";
+        if (s->parentSection) {
+            file << "\"" << EscapeJSON(s->parentSection) << "\",\n";
+        } else {
+            file << "null,\n";
+        }
+        writePerfCountersJSON(file, *s);
+        writeCpuJSON(file, *s);
+        writeThreadsJSON(file, s->sectionId);
+        writeSlowCallsJSON(file, *s);
+        file << "      \"items\": " << s->items << ",\n"
+             << "      \"bytes\": " << s->bytes << ",\n"
+             << "      \"itemsPerSecond\": " << s->itemsPerSecond << ",\n"
+             << "      \"bytesPerSecond\": " << s->bytesPerSecond << ",\n";
+        file << "      \"allocations\": " << s->allocations << ",\n"
+             << "      \"allocatedBytes\": " << s->allocatedBytes << ",\n"
+             << "      \"frees\": " << s->frees << ",\n";
+        file << "      \"fileName\": \"" << EscapeJSON(s->fileName ? s->fileName : "N/A") << "\",\n"
+             << "      \"functionName\": \"" << EscapeJSON(s->functionName ? s->functionName : "N/A") << "\",\n"
+             << "      \"lineNumber\": " << s->lineNumber << "\n"
+             << "    }";
+    }
+    file << "\n";
+
+    file << "  ]"; // Close the sections array
+}
+
+// Writes a section's "perfCounters" member: null when no call was counted, otherwise the summed
+// deltas (null for counters that could not be opened) and the derived ratios
+void Profiler::writePerfCountersJSON(std::ofstream& file, ProfilerStats const& s) {
+    file << "      \"perfCounters\": ";
+    if (s.perfCalls == 0) {
+        file << "null,\n";
+        return;
+    }
+    file << "{\n"
+         << "        \"calls\": " << s.perfCalls << ",\n";
+    for (int kind = 0; kind < PERF_COUNTER_COUNT; ++kind) {
+        file << "        \"" << GetPerfCounterName(kind) << "\": ";
+        if (s.perfCounterMask & (1u << kind)) {
+            file << s.perfCounts[kind] << ",\n";
+        } else {
+            file << "null,\n";
+        }
+    }
+    file << "        \"ipc\": " << s.ipc << ",\n"
+         << "        \"cacheMissesPerKiloInstruction\": " << s.cacheMissesPerKiloInstruction << ",\n"
+         << "        \"branchMissesPerKiloInstruction\": " << s.branchMissesPerKiloInstruction << "\n"
+         << "      },\n";
+}
+
+// One line per thread that ran the section, when more than one did or CPU time was recorded
+void Profiler::printThreadBreakdown(int sectionId) {
+    int threadsWithCalls = 0;
+    bool cpuTimed = false;
+    for (ThreadStatsReport const& report: threadReports) {
+        if (ThreadSectionTotals const* s = report.Find(sectionId)) {
+            ++threadsWithCalls;
+            cpuTimed = cpuTimed || s->cpuCalls > 0;
+        }
+    }
+    if (threadsWithCalls < 2 && !cpuTimed) {
+        return;
+    }
+    for (ThreadStatsReport const& report: threadReports) {
+        ThreadSectionTotals const* found = report.Find(sectionId);
+        if (!found) {
+            continue;
+        }
+        ThreadSectionTotals const& s = *found;
+        printf("    thread %i (tid %llu%s)", report.threadIndex, (unsigned long long)report.osThreadId,
+               report.exited ? ", exited" : "");
+        printf(": %i calls for %.06fms; avg=%.06fms", s.count, 1000.0 * s.totalTime, 1000.0 * s.avgTime);
+        if (s.cpuCalls > 0) {
+            printf("; cpu=%.06fms (%.01f%%), switches %llu/%llu", 1000.0 * s.cpuTime, 100.0 * s.cpuUtilization,
+                   (unsigned long long)s.voluntarySwitches, (unsigned long long)s.involuntarySwitches);
+        }
+        printf("\n");
+    }
+}
+
+// Writes a section's "cpu" member: null when CPU time was off for all its calls
+void Profiler::writeCpuJSON(std::ofstream& file, ProfilerStats const& s) {
+    file << "      \"cpu\": ";
+    if (s.cpuCalls == 0) {
+        file << "null,\n";
+        return;
+    }
+    file << "{\n"
+         << "        \"calls\": " << s.cpuCalls << ",\n"
+         << "        \"cpuTime\": " << (1000.0 * s.cpuTime) << ",\n" // Milliseconds, like the wall times
+         << "        \"utilization\": " << s.cpuUtilization << ",\n"
+         << "        \"voluntarySwitches\": " << s.voluntarySwitches << ",\n"
+         << "        \"involuntarySwitches\": " << s.involuntarySwitches << "\n"
+         << "      },\n";
+}
+
+// Writes a section's "threads" member, one entry per thread that ran it
+void Profiler::writeThreadsJSON(std::ofstream& file, int sectionId) {
+    file << "      \"threads\": [";
+    bool first = true;
+    for (ThreadStatsReport const& report: threadReports) {
+        ThreadSectionTotals const* found = report.Find(sectionId);
+        if (!found) {
+            continue;
+        }
+        ThreadSectionTotals const& s = *found;
+        file << (first ? "\n" : ",\n")
+             << "        { \"thread\": " << report.threadIndex
+             << ", \"osThreadId\": " << report.osThreadId
+             << ", \"exited\": " << (report.exited ? "true" : "false")
+             << ", \"count\": " << s.count
+             << ", \"totalTime\": " << (1000.0 * s.totalTime)
+             << ", \"averageTime\": " << (1000.0 * s.avgTime)
+             << ", \"cpuTime\": ";
+        if (s.cpuCalls > 0) {
+            file << (1000.0 * s.cpuTime) << ", \"utilization\": " << s.cpuUtilization
+                 << ", \"voluntarySwitches\": " << s.voluntarySwitches
+                 << ", \"involuntarySwitches\": " << s.involuntarySwitches << " }";
+        } else {
+            file << "null, \"utilization\": null, \"voluntarySwitches\": null, \"involuntarySwitches\": null }";
+        }
+        first = false;
+    }
+    file << (first ? "],\n" : "\n      ],\n");
+}
+
+// Writes a section's "slowestCalls" member, slowest first
+void Profiler::writeSlowCallsJSON(std::ofstream& file, ProfilerStats const& s) {
+    file << "      \"slowestCalls\": [";
+    for (size_t i = 0; i < s.slowestCalls.size(); ++i) {
+        SlowCall const& call = s.slowestCalls[i];
+        file << (i == 0 ? "\n" : ",\n")
+             << "        { \"time\": " << (1000.0 * call.time)
+             << ", \"startTime\": " << (1000.0 * call.startTime)
+             << ", \"thread\": " << call.threadIndex
+             << ", \"osThreadId\": " << call.osThreadId
+             << ", \"stack\": [";
+        for (size_t level = 0; level < call.stack.size(); ++level) {
+            file << (level == 0 ? "\"" : ", \"") << EscapeJSON(GetSectionInfo(call.stack[level]).sectionName) << "\"";
+        }
+        file << "], \"tags\": {";
+        for (size_t tag = 0; tag < call.tags.size(); ++tag) {
+            file << (tag == 0 ? " \"" : ", \"") << EscapeJSON(GetTagKey(call.tags[tag])) << "\": \"" << EscapeJSON(GetTagValue(call.tags[tag])) << "\"";
+        }
+        file << (call.tags.empty() ? "} }" : " } }");
+    }
+    file << (s.slowestCalls.empty() ? "],\n" : "\n      ],\n");
+}
+
+// Writes node and its subtree as a nested JSON object
+void Profiler::writeCallTreeJSON(std::ofstream& file, int node, int depth) {
+    CallTreeNode const& n = callTree[node];
+    std::string indent(2 * depth, ' ');
+
+    file << indent << "{\n"
+         << indent << "  \"sectionName\": \"" << EscapeJSON(stats[n.sectionId].sectionName) << "\",\n"
+         << indent << "  \"count\": " << n.count << ",\n"
+         << indent << "  \"async\": " << (n.async ? "true" : "false") << ",\n"
+         << indent << "  \"inclusiveTime\": " << (1000.0 * TicksToSeconds(n.inclusiveTicks)) << ",\n"
+         << indent << "  \"exclusiveTime\": " << (1000.0 * TicksToSeconds(n.ExclusiveTicks())) << ",\n"
+         << indent << "  \"allocations\": " << n.allocations << ",\n"
+         << indent << "  \"allocatedBytes\": " << n.allocatedBytes << ",\n"
+         << indent << "  \"children\": [";
+    for (int child = n.firstChild; child != -1; child = callTree[child].nextSibling) {
+        file << "\n";
+        writeCallTreeJSON(file, child, depth + 2);
+        if (callTree[child].nextSibling != -1) {
+            file << ",";
+        }
     }
+    file << (n.firstChild == -1 ? "]\n" : "\n" + indent + "  ]\n");
+    file << indent << "}";
 }
 
 void Profiler::printStatsToCSV(const char* fileName) {
+    calculateStats();
+
+    // The JSON's section fields, flattened: one row per section with calls, then one per thread
+    // that ran it with the thread columns set. Times are in milliseconds like the JSON; a JSON
+    // null, and any column a thread row does not have, is an empty field. slowestCalls and the
+    // call tree do not fit a table and are left to the JSON.
     std::ofstream file(fileName);
     if (file.is_open()) {
-        file << "{\n";
-        file << "  \"sections\": [\n";
-
-        // Iterator for statistics map
-        for (auto iter = stats.begin(); iter != stats.end(); ++iter) {
-            ProfilerStats* s = iter->second;
-            double average = (s->count > 0) ? (s->totalTime / s->count) : 0.0;
-
-            // Write the JSON object for this section
-            file << "    {\n"
-                 << "      \"sectionName\": \"" << s->sectionName << "\",\n"
-                 << "      \"count\": " << s->count << ",\n"
-                 << "      \"totalTime\": " << (1000.0 * s->totalTime) << ",\n"
-                 << "      \"minTime\": " << (1000.0 * s->minTime) << ",\n"
-                 << "      \"maxTime\": " << (1000.0 * s->maxTime) << ",\n"
-                 << "      \"averageTime\": " << (1000.0 * average) << ",\n" // Convert to milliseconds
-                 << "      \"fileName\": \"" << (s->fileName ? s->fileName : "N/A") << "\",\n"
-                 << "      \"functionName\": \"" << (s->functionName ? s->functionName : "N/A") << "\",\n"
-                 << "      \"lineNumber\": " << s->lineNumber << "\n"
-                 << "    }";
-            
-            // Check if this is the last section to avoid a trailing comma
-            if (std::next(iter) != stats.end()) {
-                file << ",";
-            }
-            file << "\n";
+        file << "sectionName,thread,osThreadId,exited,count,sampledCount,sampledTime,sampled,samplingPolicy,totalTime,exclusiveTime,"
+                "minTime,maxTime,averageTime,stdDevTime,p50Time,p90Time,p99Time,p999Time,startTime,endTime,parentSection,"
+                "perfCalls";
+        for (int kind = 0; kind < PERF_COUNTER_COUNT; ++kind) {
+            file << "," << GetPerfCounterName(kind);
         }
+        file << ",ipc,cacheMissesPerKiloInstruction,branchMissesPerKiloInstruction,cpuCalls,cpuTime,utilization,"
+                "voluntarySwitches,involuntarySwitches,items,bytes,itemsPerSecond,bytesPerSecond,allocations,"
+                "allocatedBytes,frees,fileName,functionName,lineNumber\n";
+        std::string perfBlanks(PERF_COUNTER_COUNT + 4, ','); // perfCalls, the counters and the three ratios
+        std::string sectionBlanks(7, ',');                     // items through frees
 
-        file << "  ]\n"; // Close the sections array
-        file << "}\n";   // Close the JSON object
+        for (ProfilerStats const& s: stats) {
+            if (s.count == 0) {
+                continue; // Registered but never exited
+            }
+            std::string name = EscapeCSV(s.sectionName);
+            std::string callSite = EscapeCSV(s.fileName ? s.fileName : "N/A") + ","
+                                   + EscapeCSV(s.functionName ? s.functionName : "N/A") + ","
+                                   + std::to_string(s.lineNumber);
+            double average = (s.count > 0) ? (s.totalTime / s.count) : 0.0;
+
+            file << name << ",,,,"
+                 << s.count << ","
+                 << s.sampledCount << ","
+                 << (1000.0 * TicksToSeconds(s.sampledTicks)) << ","
+                 << (s.sampledCount < s.count ? "true" : "false") << ","
+                 << EscapeCSV(s.samplingPolicy.c_str()) << ","
+                 << (1000.0 * s.totalTime) << ","
+                 << (1000.0 * s.exclusiveTime) << ","
+                 << (1000.0 * s.minTime) << ","
+                 << (1000.0 * s.maxTime) << ","
+                 << (1000.0 * average) << ","
+                 << (1000.0 * s.stdDevTime) << ","
+                 << (1000.0 * s.p50Time) << ","
+                 << (1000.0 * s.p90Time) << ","
+                 << (1000.0 * s.p99Time) << ","
+                 << (1000.0 * s.p999Time) << ","
+                 << (1000.0 * s.startTime) << ","
+                 << (1000.0 * s.endTime) << ","
+                 << EscapeCSV(s.parentSection) << ",";
+            if (s.perfCalls > 0) {
+                file << s.perfCalls << ",";
+                for (int kind = 0; kind < PERF_COUNTER_COUNT; ++kind) {
+                    if (s.perfCounterMask & (1u << kind)) {
+                        file << s.perfCounts[kind];
+                    }
+                    file << ",";
+                }
+                file << s.ipc << "," << s.cacheMissesPerKiloInstruction << "," << s.branchMissesPerKiloInstruction << ",";
+            } else {
+                file << perfBlanks;
+            }
+            if (s.cpuCalls > 0) {
+                file << s.cpuCalls << "," << (1000.0 * s.cpuTime) << "," << s.cpuUtilization << ","
+                     << s.voluntarySwitches << "," << s.involuntarySwitches << ",";
+            } else {
+                file << ",,,,,";
+            }
+            file << s.items << ","
+                 << s.bytes << ","
+                 << s.itemsPerSecond << ","
+                 << s.bytesPerSecond << ","
+                 << s.allocations << ","
+                 << s.allocatedBytes << ","
+                 << s.frees << ","
+                 << callSite << "\n";
+
+            for (ThreadStatsReport const& report: threadReports) {
+                ThreadSectionTotals const* t = report.Find(s.sectionId);
+                if (!t) {
+                    continue;
+                }
+                file << name << ","
+                     << report.threadIndex << ","
+                     << report.osThreadId << ","
+                     << (report.exited ? "true" : "false") << ","
+                     << t->count << ",,,,,"
+                     << (1000.0 * t->totalTime) << ",,,,"
+                     << (1000.0 * t->avgTime) << ",,,,,,,,,"
+                     << perfBlanks;
+                if (t->cpuCalls > 0) {
+                    file << t->cpuCalls << "," << (1000.0 * t->cpuTime) << "," << t->cpuUtilization << ","
+                         << t->voluntarySwitches << "," << t->involuntarySwitches << ",";
+                } else {
+                    file << ",,,,,";
+                }
+                file << sectionBlanks << callSite << "\n";
+            }
+        }
         file.close();    // Close the file
 
-        std::cout << "JSON statistics successfully written to " << fileName << std::endl;
+        std::cout << "CSV statistics successfully written to " << fileName << std::endl;
     } else {
         std::cerr << "Error: Unable to open file " << fileName << std::endl;
     }
 }
 
 void Profiler::printStatsToJSON(const char* fileName) {
+    calculateStats();
+
     std::ofstream file(fileName);
     if (file.is_open()) {
         file << "{\n";
-        file << "  \"sections\": [\n";
-
-        // Iterator for statistics map
-        for (auto iter = stats.begin(); iter != stats.end(); ++iter) {
-            ProfilerStats* s = iter->second;
-            double average = (s->count > 0) ? (s->totalTime / s->count) : 0.0;
-
-            // Write the JSON object for this section
-            file << "    {\n"
-                 << "      \"sectionName\": \"" << s->sectionName << "\",\n"
-                 << "      \"count\": " << s->count << ",\n"
-                 << "      \"totalTime\": " << (1000.0 * s->totalTime) << ",\n" // Convert to milliseconds
-                 << "      \"minTime\": " << (1000.0 * s->minTime) << ",\n"
-                 << "      \"maxTime\": " << (1000.0 * s->maxTime) << ",\n"
-                 << "      \"averageTime\": " << (1000.0 * average) << ",\n"
-                 << "      \"fileName\": \"" << (s->fileName ? s->fileName : "N/A") << "\",\n"
-                 << "      \"functionName\": \"" << (s->functionName ? s->functionName : "N/A") << "\",\n"
-                 << "      \"lineNumber\": " << s->lineNumber << "\n"
-                 << "    }";
+        file << "  \"overhead\": {\n"
+             << "    \"enterExitPairTime\": " << (1000.0 * GetEnterExitOverheadSeconds()) << ",\n" // Milliseconds, like the sections
+             << "    \"emptySectionTime\": " << (1000.0 * GetEmptySectionOverheadSeconds()) << ",\n"
+             << "    \"compensated\": " << (compensateOverhead ? "true" : "false") << "\n"
+             << "  },\n";
+        writeSectionsJSON(file);
+        file << ",\n";
+        writeTagsJSON(file);
 
-            // Check if this is the last section to avoid a trailing comma
-            if (std::next(iter) != stats.end()) {
+        // Nested call tree; the root itself has no section, so write its children
+        file << "  \"callTree\": [";
+        for (int child = callTree[0].firstChild; child != -1; child = callTree[child].nextSibling) {
+            file << "\n";
+            writeCallTreeJSON(file, child, 2);
+            if (callTree[child].nextSibling != -1) {
                 file << ",";
             }
-            file << "\n";
         }
+        file << (callTree[0].firstChild == -1 ? "]\n" : "\n  ]\n");
 
-        file << "  ]\n"; // Close the sections array
         file << "}\n";   // Close the JSON object
         file.close();    // Close the file
 
@@ -286,3 +2245,67 @@ void Profiler::printStatsToJSON(const char* fileName) {
         std::cerr << "Error: Unable to open file " << fileName << std::endl;
     }
 }
+
+// Prints the kept windows oldest first, one line per section with calls in the window
+void Profiler::printSnapshots() {
+    std::vector<ProfilerSnapshot> windows = GetSnapshots();
+    printf("Snapshot windows (%zu kept):\n", windows.size());
+    for (ProfilerSnapshot const& window: windows) {
+        printf("  Window %llu, %.03fs to %.03fs:\n", (unsigned long long)window.index, window.startTime, window.endTime);
+        for (ProfilerStats const& stat: window.stats) {
+            printf("    \"%s\": %i calls for %.06fms; avg=%.06fms, max=%.06fms, p99=%.06fms\n",
+                   stat.sectionName, stat.count, 1000.0 * stat.totalTime, 1000.0 * stat.avgTime,
+                   1000.0 * stat.maxTime, 1000.0 * stat.p99Time);
+        }
+    }
+}
+
+void Profiler::printSnapshotsToJSON(const char* fileName) {
+    std::vector<ProfilerSnapshot> windows = GetSnapshots();
+
+    std::ofstream file(fileName);
+    if (file.is_open()) {
+        file << "{\n";
+        file << "  \"windows\": [";
+        for (size_t w = 0; w < windows.size(); ++w) {
+            ProfilerSnapshot const& window = windows[w];
+            double duration = window.endTime - window.startTime;
+            file << (w == 0 ? "\n" : ",\n")
+                 << "    {\n"
+                 << "      \"index\": " << window.index << ",\n"
+                 << "      \"startTime\": " << (1000.0 * window.startTime) << ",\n" // Milliseconds, like the sections
+                 << "      \"endTime\": " << (1000.0 * window.endTime) << ",\n"
+                 << "      \"sections\": [";
+            for (size_t i = 0; i < window.stats.size(); ++i) {
+                ProfilerStats const& s = window.stats[i];
+                file << (i == 0 ? "\n" : ",\n")
+                     << "        {\n"
+                     << "          \"sectionName\": \"" << EscapeJSON(s.sectionName) << "\",\n"
+                     << "          \"count\": " << s.count << ",\n"
+                     << "          \"sampledCount\": " << s.sampledCount << ",\n"
+                     << "          \"callsPerSecond\": " << (duration > 0.0 ? s.count / duration : 0.0) << ",\n"
+                     << "          \"totalTime\": " << (1000.0 * s.totalTime) << ",\n"
+                     << "          \"minTime\": " << (1000.0 * s.minTime) << ",\n"
+                     << "          \"maxTime\": " << (1000.0 * s.maxTime) << ",\n"
+                     << "          \"averageTime\": " << (1000.0 * s.avgTime) << ",\n"
+                     << "          \"stdDevTime\": " << (1000.0 * s.stdDevTime) << ",\n"
+                     << "          \"itemsPerSecond\": " << s.itemsPerSecond << ",\n"
+                     << "          \"bytesPerSecond\": " << s.bytesPerSecond << ",\n"
+                     << "          \"p50Time\": " << (1000.0 * s.p50Time) << ",\n"
+                     << "          \"p90Time\": " << (1000.0 * s.p90Time) << ",\n"
+                     << "          \"p99Time\": " << (1000.0 * s.p99Time) << ",\n"
+                     << "          \"p999Time\": " << (1000.0 * s.p999Time) << "\n"
+                     << "        }";
+            }
+            file << (window.stats.empty() ? "]\n" : "\n      ]\n")
+                 << "    }";
+        }
+        file << (windows.empty() ? "]\n" : "\n  ]\n");
+        file << "}\n";
+        file.close();
+
+        std::cout << "Snapshot windows successfully written to " << fileName << std::endl;
+    } else {
+        std::cerr << "Error: Unable to open file " << fileName << std::endl;
+    }
+}
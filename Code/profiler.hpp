@@ -4,92 +4,573 @@
 #include<cfloat>
 #include<vector>
 #include<map>
+#include<deque>
+#include<unordered_map>
 #include <string>
 #include<fstream>
-#include<stack>
 #include <mutex>
+#include<memory>
+#include<atomic>
+#include<thread>
 #include<cstring>
+#include<cstdint>
+#include<condition_variable>
 
-#define PROFILER_EXIT(sectionName) Profiler::GetInstance()->ExitSection(sectionName, __LINE__, __FILE__, __FUNCTION__)
-#define PROFILER_ENTER(sectionName) Profiler::GetInstance()->EnterSection(sectionName)
+#include "histogram.hpp"
+#include "trace_writer.hpp"
+#include "live_stats.hpp"
+#include "perf_counters.hpp"
+#include "thread_usage.hpp"
+
+#define PROFILER_CONCAT_INNER(a, b) a##b
+#define PROFILER_CONCAT(a, b) PROFILER_CONCAT_INNER(a, b)
+
+// What the macros below compile to, chosen per build (make PROFILER_FLAGS=-DPROFILER_POLICY=1) or
+// per translation unit by defining PROFILER_POLICY before including this header:
+//   OFF    the macros expand to nothing; their arguments are not even evaluated
+//   STATS  aggregate stats, call tree and the rest, but exits never write to a running trace
+//   TRACE  everything, including StartTrace's event stream (the default)
+// Direct EnterSection/ExitSection calls and ProfilerScopeObject are not affected by the policy.
+#define PROFILER_POLICY_OFF 0
+#define PROFILER_POLICY_STATS 1
+#define PROFILER_POLICY_TRACE 2
+#ifndef PROFILER_POLICY
+#define PROFILER_POLICY PROFILER_POLICY_TRACE
+#endif
+
+// The section name must be a string literal: each expansion registers it once, so a name computed
+// at runtime would charge every later call to whichever name came first. The "" name "" pasting
+// turns that mistake into a compile error. Runtime names (request types, shard names) go through
+// EnterSection/ExitSection(char const*) or ProfilerScopeObject, which look the name up per call.
+#if PROFILER_POLICY == PROFILER_POLICY_OFF
+#define PROFILER_EXIT(sectionName) do { (void)sizeof("" sectionName ""); } while (0)
+#define PROFILER_ENTER(sectionName) do { (void)sizeof("" sectionName ""); } while (0)
+#define PROFILER_SCOPE(sectionName) do { (void)sizeof("" sectionName ""); } while (0)
+#define PROFILER_ADD_ITEMS(count) do { } while (0)
+#define PROFILER_ADD_BYTES(bytes) do { } while (0)
+#define PROFILER_TAG(key, value) do { } while (0)
+#else
+// Each macro expansion owns a static ProfilerCallSite, registered the first time it runs.
+// After that, enter/exit only pass the section's integer id around.
+#define PROFILER_EXIT(sectionName) do { \
+        static ProfilerCallSite const profilerCallSite("" sectionName "", __FILE__, __FUNCTION__, __LINE__); \
+        Profiler::GetInstance()->ExitSectionAs<PROFILER_POLICY>(profilerCallSite.sectionId); \
+    } while (0)
+#define PROFILER_ENTER(sectionName) do { \
+        static ProfilerCallSite const profilerCallSite("" sectionName "", __FILE__, __FUNCTION__, __LINE__); \
+        Profiler::GetInstance()->EnterSection(profilerCallSite); \
+    } while (0)
+#define PROFILER_SCOPE(sectionName) \
+    static ProfilerCallSite const PROFILER_CONCAT(profilerCallSite, __LINE__)("" sectionName "", __FILE__, __FUNCTION__, __LINE__); \
+    ProfilerPolicyScope<PROFILER_POLICY> PROFILER_CONCAT(profilerScope, __LINE__)(PROFILER_CONCAT(profilerCallSite, __LINE__))
+#define PROFILER_ADD_ITEMS(count) Profiler::GetInstance()->AddItems(count)
+#define PROFILER_ADD_BYTES(bytes) Profiler::GetInstance()->AddBytes(bytes)
+#define PROFILER_TAG(key, value) Profiler::GetInstance()->AddTag(key, value)
+#endif
+
+
+// Describes one place in the source that enters or exits a section. Sections are keyed by name,
+// so every call site using the same name shares one dense sectionId.
+class ProfilerCallSite{
+    public:
+        ProfilerCallSite(char const* sectionName, const char* fileName, const char* functionName, int lineNumber);
+        ProfilerCallSite(char const* sectionName, const char* fileName, const char* functionName, int lineNumber, int sectionId); // Already registered
+
+        char const* sectionName;
+        const char* fileName;
+        const char* functionName;
+        int lineNumber;
+        int sectionId;
+};
+
+
+// How often a section is actually timed. Calls that are not sampled still count and still
+// nest correctly, but skip both clock reads; totals are scaled up by calls / sampled calls.
+class ProfilerSamplingPolicy{
+    public:
+        enum Mode { EveryCall, FixedRate, TimeInterval, Adaptive };
+
+        ProfilerSamplingPolicy() : mode(EveryCall), rate(1), intervalSeconds(0.0), maxCallsPerSecond(0.0) {}
+
+        static ProfilerSamplingPolicy OneIn(uint32_t rate);                    // Time every rate-th call
+        static ProfilerSamplingPolicy Interval(double seconds);                // At most one timed call per interval
+        static ProfilerSamplingPolicy AdaptiveLimit(double maxCallsPerSecond); // Time every call until the section
+                                                                               // runs hotter than this, then thin out
+        std::string Describe() const;
+
+        Mode mode;
+        uint32_t rate;
+        double intervalSeconds;
+        double maxCallsPerSecond;
+};
+
+// One thread's sampling state for one section, refreshed whenever a policy changes
+class SectionSampler{
+    public:
+        SectionSampler() : mode(ProfilerSamplingPolicy::EveryCall), rate(1), countdown(1), intervalTicks(0),
+                           nextSampleTicks(0), windowStartTicks(0), windowCalls(0), maxCallsPerSecond(0.0) {}
+
+        void Reset(ProfilerSamplingPolicy const& policy);
+        bool Sample();                    // Decides whether this call is timed; EveryCall never gets here
+
+        ProfilerSamplingPolicy::Mode mode;
+        uint32_t rate;                    // Current 1-in-N for FixedRate and Adaptive
+        uint32_t countdown;               // Calls left until the next timed one
+        uint64_t intervalTicks;           // TimeInterval spacing, or the Adaptive rate-measuring window
+        uint64_t nextSampleTicks;         // TimeInterval: earliest next timed call
+        uint64_t windowStartTicks;        // Adaptive: start of the current window, 0 before the first call
+        uint64_t windowCalls;             // Adaptive: calls seen in the current window
+        double maxCallsPerSecond;
+};
 
 
 class TimeRecordStart{
     public: 
-        TimeRecordStart(char const* sectionName, double secondsAtStart);
+        TimeRecordStart(int sectionId, uint64_t ticksAtStart, int callTreeNode, bool sampled, bool counted, bool cpuTimed);
         ~TimeRecordStart();
 
-        char const* sectionName; 
-        double secondsAtStart; 
+        int sectionId; 
+        uint64_t ticksAtStart;   // Raw clock ticks, see time.hpp
+        int callTreeNode;        // This call's node in the owning thread's call tree
+        bool sampled;            // False when the sampling policy skipped timing this call
+        bool counted;            // Hardware counters were read at entry, see ThreadProfilerData::perfStarts
+        bool cpuTimed;           // CPU time was read at entry, see ThreadProfilerData::cpuStarts
 
 
 };
 
-class TimeRecordStop{
-    public: 
-        TimeRecordStop(char const* sectionName, double secondsAtStop, int lineNumber, const char* fileName, const char* functionName);
-        TimeRecordStop(char const* sectionName, double secondsAtStop);
-        ~TimeRecordStop();
+// Calls of one section that carried one tag; each pair gets its own stats
+struct ProfilerTagGroup {
+    int sectionId;
+    int tagId;
+};
 
-        char const* sectionName; 
-        double elapsedTime; 
-        double secondsAtStop; 
-        int lineNumber; 
-        const char* fileName; 
-        const char* functionName; 
+// A tag attached to the active section at depth (its index in startTimes plus one)
+struct ActiveTag {
+    size_t depth;
+    int tagId;
+};
 
+// One of a section's slowest calls, with enough context to find it in a trace or a log
+struct SlowCall {
+    uint64_t ticks;              // Duration
+    uint64_t startTicks;
+    int threadIndex;             // ThreadProfilerData::threadIndex of the calling thread
+    uint64_t osThreadId;
+    std::vector<int> stack;      // Section ids active at the time, outermost first, ending with this section
+    std::vector<int> tags;       // Tag ids attached to the call, see Profiler::AddTag
+    double time;                 // Duration in seconds (filled by UpdateTimes)
+    double startTime;            // Seconds since the clock was initialized
 };
 
 class ProfilerStats {
 public:
     const char* sectionName;     // Name of the section
+    int sectionId;               // Dense id from Profiler::RegisterSection
     int count;                   // Number of times the section was called
-    double totalTime;            // Total time spent in the section
+    int sampledCount;            // Calls that were actually timed; less than count under a sampling policy
+    uint64_t totalTicks;         // Total clock ticks of timed calls (scaled to all calls by ExtrapolateSamples)
+    uint64_t minTicks;           // Fewest ticks taken by a call
+    uint64_t maxTicks;           // Most ticks taken by a call
+    uint64_t exclusiveTicks;     // Ticks not spent in nested sections (from the call tree)
+    uint64_t firstStartTicks;    // Earliest call start, for the timeline
+    uint64_t lastStopTicks;      // Latest call end
+    uint64_t sampledTicks;       // Raw ticks of timed calls, before extrapolation and overhead compensation
+    double sumSquaredTicks;      // Sum of squared per-call ticks, for the variance
+    double totalTime;            // Total time spent in the section, in seconds (filled by UpdateTimes)
     double minTime;              // Minimum time taken for a call
     double maxTime;              // Maximum time taken for a call
     double avgTime;              // Average time taken per call
+    double stdDevTime;           // Sample standard deviation of timed calls
+    double exclusiveTime;        // Self time in seconds, excluding nested sections
+    double startTime;            // First start, in seconds since the clock was initialized
+    double endTime;              // Last end, in seconds since the clock was initialized
+    double p50Time;              // Median call time, in seconds (from the histogram)
+    double p90Time;
+    double p99Time;
+    double p999Time;             // 99.9th percentile
+    const char* parentSection;   // Section this one spends the most time under, nullptr at top level
+    std::string samplingPolicy;  // ProfilerSamplingPolicy::Describe() of the section's policy
     const char* fileName;        // Name of the file where the section is defined
     const char* functionName;    // Name of the function where the section is defined
     int lineNumber;              // Line number where the section begins
+    uint64_t perfCounts[PERF_COUNTER_COUNT]; // Hardware counter deltas summed over perfCalls, children included
+    int perfCalls;               // Timed calls that also read counters; 0 when they were off or unavailable
+    uint32_t perfCounterMask;    // Bit per PerfCounterKind that actually opened
+    double ipc;                  // Instructions per cycle (filled by UpdateTimes)
+    double cacheMissesPerKiloInstruction;
+    double branchMissesPerKiloInstruction;
+    uint64_t allocations;        // Heap allocations made while this was the innermost section (from the call tree)
+    uint64_t allocatedBytes;     // Bytes requested by those allocations
+    uint64_t frees;              // Deallocations made while this was the innermost section
+    uint64_t cpuNanoseconds;     // Thread CPU time summed over cpuCalls, children included
+    uint64_t voluntarySwitches;  // Context switches while blocked, over cpuCalls
+    uint64_t involuntarySwitches; // Preemptions, over cpuCalls
+    int cpuCalls;                // Timed calls that also read CPU time; 0 when it was off
+    double cpuTime;              // cpuNanoseconds in seconds (filled by UpdateTimes)
+    double cpuUtilization;       // CPU time over wall time for the same calls; well below 1 means blocked
+    uint64_t items;              // Work reported with Profiler::AddItems, over every call
+    uint64_t bytes;              // Work reported with Profiler::AddBytes
+    double itemsPerSecond;       // Over totalTime (filled by UpdateTimes)
+    double bytesPerSecond;
+    uint64_t slowCallThresholdTicks; // A call must take longer than this to enter slowestCalls; 0 until it is full
+    std::vector<SlowCall> slowestCalls; // Slowest first, at most Profiler::GetSlowCallCapacity()
+    LatencyHistogram histogram;  // Per-call ticks; percentiles are read from this at report time
 
     // Constructor that initializes all fields
-    ProfilerStats(const char* name, const char* file, const char* function, int line)
-        : sectionName(name), count(0), totalTime(0.0), minTime(DBL_MAX),
-          maxTime(DBL_MIN), avgTime(0.0), fileName(file), functionName(function), lineNumber(line) {}
+    ProfilerStats(const char* name = nullptr, const char* file = nullptr, const char* function = nullptr, int line = 0, int id = -1)
+        : sectionName(name), sectionId(id), count(0), sampledCount(0), totalTicks(0), minTicks(UINT64_MAX), maxTicks(0), exclusiveTicks(0), firstStartTicks(UINT64_MAX),
+          lastStopTicks(0), sampledTicks(0), sumSquaredTicks(0.0), totalTime(0.0), minTime(DBL_MAX), maxTime(DBL_MIN), avgTime(0.0), stdDevTime(0.0), exclusiveTime(0.0), startTime(0.0), endTime(0.0),
+          p50Time(0.0), p90Time(0.0), p99Time(0.0), p999Time(0.0), parentSection(nullptr), fileName(file), functionName(function), lineNumber(line),
+          perfCounts(), perfCalls(0), perfCounterMask(0), ipc(0.0), cacheMissesPerKiloInstruction(0.0), branchMissesPerKiloInstruction(0.0),
+          allocations(0), allocatedBytes(0), frees(0), cpuNanoseconds(0), voluntarySwitches(0), involuntarySwitches(0), cpuCalls(0),
+          cpuTime(0.0), cpuUtilization(0.0), items(0), bytes(0), itemsPerSecond(0.0), bytesPerSecond(0.0),
+          slowCallThresholdTicks(0) {}
 
     ~ProfilerStats() {} // Destructor
+
+    void Merge(ProfilerStats const& other); // Fold another thread's stats for the same section into this one
+    void Reset();                           // Zero the counters, keeping the section's identity
+    void RecordCall(uint64_t ticksAtStart, uint64_t ticksAtStop); // Count one timed call
+    SlowCall& AddSlowCall(uint64_t ticks); // Slot for a call that beat slowCallThresholdTicks, kept in order
+    void ExtrapolateSamples();              // Scale totalTicks from the timed calls up to every call
+    void UpdateTimes();                     // Convert the tick counters to seconds for reporting
+};
+
+
+// Flat stats for one interval between two TakeSnapshot calls. A call belongs to the window it
+// exited in. Only sections with calls in the window are listed, with sampled totals extrapolated;
+// exclusive time and the call tree are only reported cumulatively.
+class ProfilerSnapshot{
+    public:
+        ProfilerSnapshot() : index(0), startTicks(0), endTicks(0), startTime(0.0), endTime(0.0) {}
+
+        uint64_t index;                    // Counts snapshots taken since the Profiler was created
+        uint64_t startTicks;               // Window bounds in raw clock ticks
+        uint64_t endTicks;
+        double startTime;                  // Window bounds in seconds since the clock was initialized
+        double endTime;
+        std::vector<ProfilerStats> stats;  // UpdateTimes already applied
 };
 
 
+// One node per distinct path of nested sections (e.g. Trig Speed Test > Total Cos and Sin Compute).
+// Nodes live in a flat vector and link by index; node 0 is the root and has no section.
+class CallTreeNode{
+    public:
+        CallTreeNode(int sectionId, int parent);
+
+        int sectionId;
+        int parent;              // Index of the enclosing node, -1 for the root
+        int firstChild;          // Index of the first child, -1 if none
+        int lastChild;           // Index of the last child, so new children append without a walk
+        int nextSibling;         // Index of the next node with the same parent, -1 if last
+        int count;               // Calls along this exact path
+        int sampledCount;        // Calls that were timed
+        uint64_t inclusiveTicks; // Time in this node including its children (timed calls only until merged)
+        uint64_t childTicks;     // Time in direct children, filled when merged; exclusive = inclusive - childTicks
+        uint64_t allocations;    // Allocations made while this node was innermost; the root holds those outside any section
+        uint64_t allocatedBytes;
+        uint64_t frees;
+        bool async;              // Span node (see Profiler::BeginSpan); its time is not taken out of the parent's self time
+
+        uint64_t ExclusiveTicks() const { return inclusiveTicks > childTicks ? inclusiveTicks - childTicks : 0; }
+};
+
+
+// Handle for a span from Profiler::BeginSpan. Copy it freely and end it on any thread, exactly once.
+class ProfilerSpan{
+    public:
+        ProfilerSpan() : sectionId(-1), pathId(0), ticksAtStart(0) {}
+
+        int sectionId;
+        int pathId;              // Where the span sits in the call tree, 0 once ended
+        uint64_t ticksAtStart;
+};
+
+// Calls and time of spans that ended on one thread, per span path
+struct SpanPathTotals {
+    uint64_t count;
+    uint64_t ticks;
+};
+
+
+// Everything one thread records. Only the owning thread touches it while sections are running,
+// so EnterSection/ExitSection never take a lock; the Profiler merges these at report time.
+class ThreadProfilerData{
+    public:
+        ThreadProfilerData(std::thread::id threadId, int threadIndex);
+        ~ThreadProfilerData();
+
+        std::thread::id threadId;
+        int threadIndex;                                   // Dense index in registration order
+        uint64_t osThreadId;                               // Kernel thread id, 0 where unavailable
+        std::vector<ProfilerStats> stats[2];               // Double-buffered by window, indexed by sectionId
+        std::atomic<int> activeStats;                      // Buffer the owner records into; only the harvester flips it
+        std::atomic<bool> recordingStats;                  // Set while the owner is writing to a stats buffer
+        std::vector<TimeRecordStart> startTimes;           // This thread's active sections, innermost last
+        TraceChunk* traceChunk;                            // Chunk this thread is filling while a trace is running
+        uint64_t traceChunkSequence;                       // Numbers this thread's chunks in the trace file
+        std::vector<CallTreeNode> callTree;                // This thread's call tree, node 0 is the root
+        std::unordered_map<uint64_t, int> childNodes;      // parent << 32 | sectionId -> child node, for wide fan-out
+        int currentNode;                                   // Node of the innermost active section (0 when none)
+        std::vector<SectionSampler> samplers;              // Indexed by sectionId
+        unsigned samplingGeneration;                       // Policy generation the samplers were built from
+        PerfCounterGroup perfCounters;                     // Opened on this thread's first counted section
+        int perfState;                                     // 0 not tried yet, 1 open, -1 unavailable on this thread
+        std::vector<PerfCounterValues> perfStarts;         // Counter values at entry of the counted active sections
+        int cpuState;                                      // 0 not tried yet, 1 readable, -1 unavailable on this thread
+        std::vector<ThreadCpuUsage> cpuStarts;             // CPU usage at entry of the CPU-timed active sections
+        std::vector<ProfilerStats> harvestedStats;         // This thread's share of Profiler::harvestedStats, harvester only
+        std::vector<ProfilerStats> tagStats[2];            // Like stats, indexed by tag group id
+        std::vector<ActiveTag> activeTags;                 // Tags of the active sections, innermost last
+        std::unordered_map<uint64_t, int> tagGroupCache;   // sectionId << 32 | tagId -> tag group id, avoids the registry lock
+        std::vector<int> nodeSpanPaths;                    // Span path of each callTree node, -1 until a span begins under it
+        std::unordered_map<uint64_t, int> spanPathCache;   // (parent path, section, async) -> path id, avoids the table lock
+        std::vector<SpanPathTotals> spanTotals;            // Spans this thread ended, indexed by path id
+
+        // Brackets every stats write. The flag is published before the buffer index is read, so once
+        // the harvester has flipped activeStats and seen the flag clear, the old buffer is its alone.
+        int BeginStatsUpdate() { recordingStats.store(true, std::memory_order_seq_cst); return activeStats.load(std::memory_order_seq_cst); }
+        void EndStatsUpdate() { recordingStats.store(false, std::memory_order_release); }
+
+        ProfilerStats& GetStats(int buffer, int sectionId); // Grows stats when a section registered after the last call
+        ProfilerStats& GetTagStats(int buffer, int tagGroup);
+        int GetChildNode(int parent, int sectionId);       // Finds or adds the child of parent for sectionId
+        SectionSampler& GetSampler(int sectionId);         // Rebuilds samplers when a policy changed
+};
+
+// One section's totals on one thread. Sampled totals are extrapolated; overhead compensation is
+// only applied to the merged stats.
+struct ThreadSectionTotals {
+    int sectionId;
+    int count;
+    double totalTime;
+    double avgTime;
+    int cpuCalls;                                          // Calls that read the CPU clock, 0 when CPU time was off
+    double cpuTime;
+    double cpuUtilization;
+    uint64_t voluntarySwitches;
+    uint64_t involuntarySwitches;
+};
+
+// One thread's totals for the sections it ran, for the per-thread breakdown. Live threads are
+// summarized by calculateStats; an exited thread's summary is taken when it retires and kept.
+struct ThreadStatsReport {
+    int threadIndex;
+    uint64_t osThreadId;
+    bool exited;
+    std::vector<ThreadSectionTotals> sections;             // Only sections with calls, by ascending sectionId
+
+    ThreadSectionTotals const* Find(int sectionId) const;  // nullptr when the thread never ran the section
+};
 
 class Profiler{
     public: 
         Profiler(); 
         ~Profiler();
 
+        void EnterSection(ProfilerCallSite const& callSite);
+        void ExitSection(ProfilerCallSite const& callSite);
+        void EnterSection(int sectionId);
+        void ExitSection(int sectionId);
+        // Exit for the macros; PROFILER_POLICY_STATS drops the trace write at compile time
+        template <int Policy> void ExitSectionAs(int sectionId);
+
+        // Spans for async and task-based work: BeginSpan returns a token that EndSpan accepts on any
+        // thread, in any order, with no per-thread stack involved. The span's parent is the given span
+        // or, without one, the innermost section on the beginning thread; it shows in the call tree
+        // as an async child there. Spans are not written to traces.
+        ProfilerSpan BeginSpan(ProfilerCallSite const& callSite, ProfilerSpan const* parent = nullptr);
+        ProfilerSpan BeginSpan(char const* sectionName, ProfilerSpan const* parent = nullptr);
+        ProfilerSpan BeginSpanById(int sectionId, ProfilerSpan const* parent = nullptr);
+        void EndSpan(ProfilerSpan& span);
+
+        // Throughput: charge work to the calling thread's innermost active section, any number of
+        // times per call. Reports then show items/s and bytes/s over the section's total time, so
+        // calls with different batch sizes compare fairly.
+        void AddItems(uint64_t count);
+        void AddBytes(uint64_t bytes);
+
+        // Key/value tags on the calling thread's innermost active section, e.g. AddTag("request", "GET").
+        // Each (section, tag) pair gets its own stats, so one "Handle Request" section can be split by
+        // request type without a section per type; the exporters list each tag's sections. InternTag
+        // returns a stable id for the pair, which is the cheapest way to tag a hot section.
+        static int InternTag(char const* key, char const* value);
+        static char const* GetTagKey(int tagId);
+        static char const* GetTagValue(int tagId);
+        void AddTag(int tagId);
+        void AddTag(char const* key, char const* value);
+
+        // Name-based API. Names are interned by content, so a name built at runtime can be freed right
+        // after the call; only a name's first use takes a lock.
         void EnterSection(char const* sectionName);
         void ExitSection(char const* sectionName);
         void ExitSection(char const* sectionName,int lineNumber, const char* fileName, const char* functionName);
 
+        // Returns the dense id for sectionName, creating it on first use. The first call site that
+        // supplies a location becomes the section's reported file/function/line.
+        static int RegisterSection(char const* sectionName, const char* fileName, const char* functionName, int lineNumber);
+        static int GetSectionCount();
+        static ProfilerCallSite GetSectionInfo(int sectionId);
+        static int RegisterTagGroup(int sectionId, int tagId);
+        static ProfilerTagGroup GetTagGroup(int tagGroup);
+        static int GetTagGroupCount();
+
+        // Per-section sampling; takes effect on each thread's next enter of any section
+        static void SetSamplingPolicy(int sectionId, ProfilerSamplingPolicy const& policy);
+        static void SetSamplingPolicy(char const* sectionName, ProfilerSamplingPolicy const& policy);
+        static ProfilerSamplingPolicy GetSamplingPolicy(int sectionId);
+        static std::atomic<unsigned> samplingGeneration;   // Bumped on every policy change
+        int GetSectionId(char const* sectionName);
+
+        // Streams every completed call to a binary trace file (see trace_format.hpp) through a fixed
+        // pool of chunkCount chunks. Stop the trace, like the exporters, once instrumented threads are idle.
+        bool StartTrace(const char* fileName, size_t chunkCount = 64);
+        void StopTrace();
+
+        // Measures what one enter/exit pair costs on this machine; the constructor runs it once.
+        // With compensation on, calculateStats subtracts that cost from inclusive times: the section's
+        // own share per call, plus one full pair per nested call beneath it.
+        void CalibrateOverhead();
+        void SetOverheadCompensation(bool enabled) { compensateOverhead = enabled; }
+
+        // Also reads cycles, instructions, cache misses and branch misses around every timed section
+        // (PROFILER_PERF_COUNTERS=1 turns this on at startup). Threads that cannot open counters,
+        // e.g. in a VM without a PMU, keep timing without them after a single warning.
+        void SetPerfCounters(bool enabled) { perfCountersEnabled.store(enabled, std::memory_order_relaxed); }
+        bool GetPerfCounters() const { return perfCountersEnabled.load(std::memory_order_relaxed); }
+
+        // Also reads the thread's CPU time and context switches around every timed section
+        // (PROFILER_CPU_TIME=1 turns this on at startup), so a section that waits on I/O or a lock
+        // can be told apart from one that computes. Costs two system calls per enter and per exit,
+        // made outside the section's wall time; utilization is capped at 100% for short sections.
+        void SetCpuTime(bool enabled) { cpuTimeEnabled.store(enabled, std::memory_order_relaxed); }
+        bool GetCpuTime() const { return cpuTimeEnabled.load(std::memory_order_relaxed); }
+
+        // Each section keeps its capacity slowest calls with their thread, start time and section
+        // stack (default 5, 0 turns it off). A call only pays more than one compare when it is
+        // slower than the current last entry.
+        static void SetSlowCallCapacity(size_t capacity) { slowCallCapacity.store(capacity, std::memory_order_relaxed); }
+        static size_t GetSlowCallCapacity() { return slowCallCapacity.load(std::memory_order_relaxed); }
+        static std::atomic<size_t> slowCallCapacity;
+
+        // Allocation attribution. Building with -DPROFILER_TRACK_ALLOCATIONS replaces global operator
+        // new/delete (alloc_tracker.cpp); SetAllocationTracking(true) then charges every allocation and
+        // free to the innermost active section of the calling thread. Returns false in other builds.
+        static bool SetAllocationTracking(bool enabled);
+        static void RecordAllocation(size_t bytes);        // Called by the replaced operators only
+        static void RecordFree();
+        static std::atomic<bool> allocationTracking;
+        double GetEnterExitOverheadSeconds() const;   // Cost of one pair as seen by the enclosing section
+        double GetEmptySectionOverheadSeconds() const; // Time an empty section reports for itself
+
+        // Rolling windows for long-running processes. Each snapshot swaps every thread's stats buffer
+        // without stopping it and keeps what was recorded since the previous snapshot; the last
+        // SetSnapshotHistory windows are kept. Call TakeSnapshot per frame, or run the timer.
+        ProfilerSnapshot TakeSnapshot();
+        void SetSnapshotHistory(size_t windowCount);
+        std::vector<ProfilerSnapshot> GetSnapshots();
+        bool StartSnapshotTimer(double intervalSeconds);
+        void StopSnapshotTimer();
+        void printSnapshots();
+        void printSnapshotsToJSON(const char* fileName);
+
+        // Publishes cumulative per-section stats to POSIX shared memory every intervalSeconds, for
+        // tools/profiler_live.cpp or any reader of live_format.hpp. Uses the same buffer swap as
+        // snapshots, so instrumented threads never wait on a reader. The region is named
+        // /profiler_live.<pid> unless name is given, and is not opened if the name is taken.
+        bool StartLiveStats(const char* name = nullptr, double intervalSeconds = 0.1, size_t sectionCapacity = 1024);
+        void StopLiveStats();
+
         void calculateStats(); 
         void printStats();
+        // Folds the calling thread's records into the exited threads' totals, keeps a per-section
+        // summary of it for the thread breakdown and frees its buffer.
+        // Runs by itself when a thread that entered a section exits; call it early from a pooled
+        // thread that will not profile again.
+        void ReleaseThreadData();
+
+        void printCallTree();
         void printStatsToCSV(const char* fileName);
         void printStatsToJSON(const char* fileName);
 
         static Profiler* gProfiler;
-        static Profiler* GetInstance();
+        static Profiler* GetInstance() { return gProfiler ? gProfiler : CreateInstance(); } // Inline fast path for the macros
 
 
     private: 
-        void ReportSectionTime(char const* sectionName, double elapsedTime);
-        void ReportSectionTime(char const* sectionName, double elapsedTime, int lineNumber, const char* fileName, const char* functionName );
-        std::map<char const*, ProfilerStats*> stats; 
-        std::vector<TimeRecordStart> startTimes; 
-        std::vector<TimeRecordStop> elapsedTimes; 
-        std::mutex mutex_; 
-        std::stack<std::string> activeSections; // Stack to track active sections
+        static Profiler* CreateInstance();
+        ThreadProfilerData* GetThreadData();
+        ThreadProfilerData* PeekThreadData();              // This thread's data if already registered, never allocates
+        void HarvestThreadStats();
+        void HarvestBuffer(ThreadProfilerData* data, int buffer);
+        void RetireThreadData(bool keepRecords);
+        std::vector<ThreadProfilerData*> AllThreadData();  // Live threads in registration order, then retiredThreads
+        void SnapshotLoop(double intervalSeconds);
+        void PublishLiveStats();
+        bool ReadPerfCountersAtEntry(ThreadProfilerData* data);
+        bool ReadCpuUsageAtEntry(ThreadProfilerData* data);
+        void AddWork(uint64_t items, uint64_t bytes);
+        void RecordTaggedCall(ThreadProfilerData* data, int buffer, int sectionId, size_t depth, uint64_t ticksAtStart, uint64_t ticksAtStop, bool sampled);
+        void ReportSectionTime(ThreadProfilerData* data, int sectionId, uint64_t ticksAtStart, uint64_t ticksAtStop);
+        void ReportMismatchedExit(int exitingSectionId, int activeSectionId);
+        void MergeCallTree(ThreadProfilerData const& data, int threadNode, int mergedNode);
+        int GetMergedChild(int parent, int sectionId, bool async);
+        int InternSpanPath(ThreadProfilerData* data, int parentPath, int sectionId, bool async);
+        int GetNodeSpanPath(ThreadProfilerData* data, int node);
+        void MergeSpans();
+        int ResolveSpanPath(int path, std::vector<int>& mergedNodes);
+        void SubtractOverhead();
+        void RebuildChildTicks();
+        void printCallTreeNode(int node, int depth);
+        void writeSectionsJSON(std::ofstream& file);
+        void writePerfCountersJSON(std::ofstream& file, ProfilerStats const& s);
+        void writeCpuJSON(std::ofstream& file, ProfilerStats const& s);
+        void writeThreadsJSON(std::ofstream& file, int sectionId);
+        void writeSlowCallsJSON(std::ofstream& file, ProfilerStats const& s);
+        void writeTagsJSON(std::ofstream& file);
+        void printTags();
+        void RecordSlowCall(ThreadProfilerData* data, ProfilerStats& statsEntry, int sectionId, size_t depth, uint64_t ticksAtStart, uint64_t elapsedTicks);
+        void printThreadBreakdown(int sectionId);
+        void writeCallTreeJSON(std::ofstream& file, int node, int depth);
+        const char* GetParentSectionName(int sectionId);
 
-        
+        std::vector<ProfilerStats> stats;                  // Merged view of all threads indexed by sectionId, rebuilt by calculateStats
+        std::vector<ProfilerStats> harvestedStats;         // Everything taken from thread buffers so far, indexed by sectionId
+        std::vector<ProfilerStats> harvestedTagStats;      // Same, indexed by tag group id
+        std::vector<ProfilerStats> tagStats;               // Merged per-tag view, rebuilt by calculateStats
+        std::vector<ProfilerStats> windowStats;            // Taken from thread buffers since the last snapshot
+        std::vector<CallTreeNode> callTree;                // Merged call tree of all threads, rebuilt by calculateStats
+        std::unordered_map<uint64_t, int> mergedChildren;  // parent << 32 | sectionId << 1 | async -> merged node
+        std::vector<ThreadStatsReport> threadReports;      // Per-thread stats, rebuilt by calculateStats
+        std::vector<ThreadStatsReport> exitedThreadReports; // Summaries of the exited threads, in exit order
+        std::vector<std::unique_ptr<ThreadProfilerData>> threadData; // One entry per live thread that entered a section
+        std::unique_ptr<ThreadProfilerData> retiredThreads; // Call tree and spans of exited threads
+        int nextThreadIndex;                               // Thread indexes are never reused, so trace tracks stay apart
+        std::mutex mutex_;                                 // Guards threadData registration and the merge only
+        unsigned long long instanceId;                     // Lets thread-local caches detect a recreated Profiler
+        TraceWriter traceWriter;
+        std::atomic<bool> tracing;                         // Checked on every exit; only StartTrace/StopTrace write it
+        std::vector<CallTreeNode> spanPaths;               // Interned span paths (parent = parent path id); 0 is the root
+        std::map<uint64_t, int> spanPathIds;               // Same key as ThreadProfilerData::spanPathCache
+        std::mutex spanMutex;                              // Guards spanPaths and spanPathIds
+        uint64_t overheadPairTicks;                        // From CalibrateOverhead, see GetEnterExitOverheadSeconds
+        uint64_t overheadInnerTicks;                       // From CalibrateOverhead, see GetEmptySectionOverheadSeconds
+        bool compensateOverhead;
+        std::atomic<bool> perfCountersEnabled;             // Checked on every timed enter
+        std::atomic<bool> cpuTimeEnabled;                  // Checked on every timed enter
+        std::deque<ProfilerSnapshot> snapshots;            // Oldest first, at most snapshotHistory
+        size_t snapshotHistory;
+        uint64_t snapshotCount;
+        uint64_t windowStartTicks;                         // Start of the window the next snapshot closes
+        std::thread snapshotThread;                        // Only while StartSnapshotTimer is running
+        std::mutex snapshotMutex;                          // Only used by the timer's sleep and StopSnapshotTimer
+        std::condition_variable snapshotWake;
+        bool snapshotStopping;
+        LiveStatsPublisher liveStats;
+
+        static std::atomic<unsigned long long> nextInstanceId;
 };
 
 
@@ -98,9 +579,28 @@ class ProfilerScopeObject{
     public:
 
         ProfilerScopeObject(char const* sectionName);
+        ProfilerScopeObject(ProfilerCallSite const& callSite);
 
         ~ProfilerScopeObject();
 
-        char const* sectionName;
+        int sectionId;
 
-};
\ No newline at end of file
+};
+
+// PROFILER_SCOPE's guard, exiting through the translation unit's policy
+template <int Policy>
+class ProfilerPolicyScope{
+
+    public:
+
+        ProfilerPolicyScope(ProfilerCallSite const& callSite):sectionId(callSite.sectionId){
+            Profiler::GetInstance()->EnterSection(sectionId);
+        }
+
+        ~ProfilerPolicyScope(){
+            Profiler::GetInstance()->ExitSectionAs<Policy>(sectionId);
+        }
+
+        int sectionId;
+
+};
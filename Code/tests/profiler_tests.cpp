@@ -0,0 +1,63 @@
+// Checks of measured numbers that are easy to break without noticing: each test runs instrumented
+// code and asserts a relation the results must satisfy. Build and run with `make test`; the exit
+// status is the number of failed tests.
+
+#include "profiler.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+namespace {
+    volatile int sink = 0;
+
+    ProfilerStats const* FindStats(ProfilerSnapshot const& window, char const* sectionName)
+    {
+        for (ProfilerStats const& stat: window.stats) {
+            if (strcmp(stat.sectionName, sectionName) == 0) {
+                return &stat;
+            }
+        }
+        return nullptr;
+    }
+
+    // A sampled child is extrapolated from its timed calls, so anything that inflates only the
+    // timed calls (such as CPU time reads inside the wall bracket) is multiplied by the sampling
+    // rate and can push the child past its parent.
+    bool TestSampledChildWithinParent()
+    {
+        Profiler* profiler = Profiler::GetInstance();
+        Profiler::SetSamplingPolicy("Test Sampled Child", ProfilerSamplingPolicy::OneIn(10));
+        profiler->SetCpuTime(true);
+        profiler->TakeSnapshot(); // Start a window of our own
+        for (int outer = 0; outer < 20; ++outer) {
+            PROFILER_SCOPE("Test Parent");
+            for (int i = 0; i < 5000; ++i) {
+                PROFILER_ENTER("Test Sampled Child");
+                sink = sink + i;
+                PROFILER_EXIT("Test Sampled Child");
+            }
+        }
+        profiler->SetCpuTime(false);
+        ProfilerSnapshot window = profiler->TakeSnapshot();
+
+        ProfilerStats const* parent = FindStats(window, "Test Parent");
+        ProfilerStats const* child = FindStats(window, "Test Sampled Child");
+        if (!parent || !child) {
+            printf("FAIL %s: sections missing from the window\n", __FUNCTION__);
+            return false;
+        }
+        bool passed = child->totalTime <= parent->totalTime;
+        printf("%s %s: child %.06fms (%i of %i calls timed), parent %.06fms\n", passed ? "PASS" : "FAIL", __FUNCTION__,
+               1000.0 * child->totalTime, child->sampledCount, child->count, 1000.0 * parent->totalTime);
+        return passed;
+    }
+}
+
+int main()
+{
+    Profiler* profiler = Profiler::GetInstance();
+    int failed = 0;
+    failed += TestSampledChildWithinParent() ? 0 : 1;
+    delete profiler;
+    return failed;
+}
@@ -0,0 +1,50 @@
+#include "thread_usage.hpp"
+
+#if defined(__linux__)
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+bool ReadThreadCpuTime(ThreadCpuUsage& usage)
+{
+#if defined(__linux__)
+    timespec cpuTime;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpuTime) != 0)
+    {
+        return false;
+    }
+    usage.cpuNanoseconds = (uint64_t)cpuTime.tv_sec * 1000000000ull + (uint64_t)cpuTime.tv_nsec;
+    return true;
+#else
+    (void)usage;
+    return false;
+#endif
+}
+
+bool ReadThreadContextSwitches(ThreadCpuUsage& usage)
+{
+#if defined(__linux__)
+    rusage threadUsage;
+    if (getrusage(RUSAGE_THREAD, &threadUsage) != 0)
+    {
+        return false;
+    }
+    usage.voluntarySwitches = (uint64_t)threadUsage.ru_nvcsw;
+    usage.involuntarySwitches = (uint64_t)threadUsage.ru_nivcsw;
+    return true;
+#else
+    (void)usage;
+    return false;
+#endif
+}
+
+uint64_t GetCurrentThreadOsId()
+{
+#if defined(__linux__)
+    return (uint64_t)syscall(SYS_gettid);
+#else
+    return 0;
+#endif
+}
@@ -0,0 +1,20 @@
+// include/thread_usage.hpp
+#pragma once
+
+#include <cstdint>
+
+// The calling thread's CPU time and context switches from the OS, read around sections when
+// Profiler::SetCpuTime is on. Each read is a system call, so far slower than GetCurrentTimeTicks;
+// false where the OS has no per-thread CPU clock or RUSAGE_THREAD. The two halves are separate so
+// the profiler can read the CPU clock inside a section's wall-clock bracket and the switch counts
+// outside it.
+struct ThreadCpuUsage {
+    uint64_t cpuNanoseconds;
+    uint64_t voluntarySwitches;    // Gave up the CPU: blocked on I/O, a lock or a sleep
+    uint64_t involuntarySwitches;  // Preempted while still runnable
+};
+
+bool ReadThreadCpuTime(ThreadCpuUsage& usage);          // CLOCK_THREAD_CPUTIME_ID into cpuNanoseconds
+bool ReadThreadContextSwitches(ThreadCpuUsage& usage);  // getrusage(RUSAGE_THREAD) into the switch counts
+
+uint64_t GetCurrentThreadOsId();           // Kernel thread id where there is one, for matching top/perf output
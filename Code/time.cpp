@@ -1,11 +1,119 @@
 #include "time.hpp"
 
 #include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+#if PROFILER_HAS_TSC
+#include <cpuid.h>
+#endif
+
+ClockSource gClockSource = ClockSource::Chrono;
+
+namespace {
+    double secondsPerTick = 1e-9;  // Chrono ticks are nanoseconds
+    uint64_t clockStartTicks = 0;
+    bool clockInitialized = false;
+
+    bool HasInvariantTsc()
+    {
+#if PROFILER_HAS_TSC
+        unsigned int eax, ebx, ecx, edx;
+        if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx))
+        {
+            return (edx & (1u << 8)) != 0; // Invariant TSC: constant rate, keeps ticking in deep C-states
+        }
+#endif
+        return false;
+    }
+
+    // Counts cycles across a short steady_clock interval to find the TSC frequency
+    double CalibrateTscSecondsPerTick()
+    {
+#if PROFILER_HAS_TSC
+        using namespace std::chrono;
+        auto startTime = steady_clock::now();
+        uint64_t startTicks = __rdtsc();
+        auto stopTime = startTime;
+        do
+        {
+            stopTime = steady_clock::now();
+        } while (stopTime - startTime < milliseconds(20));
+        uint64_t stopTicks = __rdtsc();
+
+        double elapsedSeconds = duration_cast<duration<double>>(stopTime - startTime).count();
+        if (stopTicks > startTicks)
+        {
+            return elapsedSeconds / double(stopTicks - startTicks);
+        }
+#endif
+        return 0.0;
+    }
+}
+
+void SetClockSource(ClockSource source)
+{
+    if (source == ClockSource::Tsc)
+    {
+        double tscSecondsPerTick = CalibrateTscSecondsPerTick();
+        if (tscSecondsPerTick <= 0.0)
+        {
+            source = ClockSource::Chrono; // No usable cycle counter, fall back
+        }
+        else
+        {
+            secondsPerTick = tscSecondsPerTick;
+        }
+    }
+    if (source == ClockSource::Chrono)
+    {
+        secondsPerTick = 1e-9;
+    }
+
+    gClockSource = source;
+    clockStartTicks = GetCurrentTimeTicks();
+    clockInitialized = true;
+}
+
+void InitializeClock()
+{
+    if (clockInitialized)
+    {
+        return;
+    }
+
+    const char* requested = std::getenv("PROFILER_CLOCK");
+    bool forceChrono = requested && strcmp(requested, "chrono") == 0;
+    SetClockSource((!forceChrono && HasInvariantTsc()) ? ClockSource::Tsc : ClockSource::Chrono);
+}
+
+ClockSource GetClockSource()
+{
+    return gClockSource;
+}
+
+const char* GetClockSourceName()
+{
+    return gClockSource == ClockSource::Tsc ? "tsc" : "chrono";
+}
+
+double GetSecondsPerTick()
+{
+    return secondsPerTick;
+}
+
+double TicksToSeconds(uint64_t ticks)
+{
+    return double(ticks) * secondsPerTick;
+}
+
+uint64_t GetClockStartTicks()
+{
+    return clockStartTicks;
+}
 
 double GetCurrentTimeSeconds()
 {
-    static auto start = std::chrono::high_resolution_clock::now();
-    auto now = std::chrono::high_resolution_clock::now(); 
-    return std::chrono::duration_cast<std::chrono::duration<double>>(now-start).count(); 
-    
+    InitializeClock();
+    return TicksToSeconds(GetCurrentTimeTicks() - clockStartTicks);
 }
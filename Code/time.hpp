@@ -1,4 +1,47 @@
 // include/time.hpp
 #pragma once
 
+#include <chrono>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PROFILER_HAS_TSC 1
+#else
+#define PROFILER_HAS_TSC 0
+#endif
+
+// Where timestamps come from. Tsc reads the raw cycle counter (calibrated against steady_clock
+// at startup); Chrono is the portable std::chrono::steady_clock path in nanoseconds.
+enum class ClockSource { Chrono, Tsc };
+
+extern ClockSource gClockSource;
+
+// Picks the clock (TSC when the CPU has an invariant counter, unless PROFILER_CLOCK=chrono is set)
+// and calibrates it. Safe to call more than once; the Profiler constructor calls it.
+void InitializeClock();
+
+// Switch backends explicitly. Do this before any section is entered: ticks recorded under one
+// source are meaningless under the other.
+void SetClockSource(ClockSource source);
+ClockSource GetClockSource();
+const char* GetClockSourceName();
+
+double GetSecondsPerTick();
+double TicksToSeconds(uint64_t ticks);
+uint64_t GetClockStartTicks();             // Tick value when the clock was initialized
+
+// Hot path: one rdtsc or one steady_clock read, no conversion.
+inline uint64_t GetCurrentTimeTicks()
+{
+#if PROFILER_HAS_TSC
+    if (gClockSource == ClockSource::Tsc)
+    {
+        return __rdtsc();
+    }
+#endif
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 double GetCurrentTimeSeconds();
@@ -0,0 +1,435 @@
+// Compares two profiler_stats.json files section by section and fails when a section got slower.
+// Build with `make compare`.
+//
+//   ./profiler_compare baseline.json current.json [--threshold 10] [--alpha 0.01] [--min-calls 2]
+//
+// A section regresses when its mean call time grew by more than --threshold percent and Welch's
+// t-test on the two runs' means gives p below --alpha. Either condition alone is not enough: a big
+// change over a handful of noisy calls is not significant, and a significant 0.5% change is not
+// worth failing a pipeline over. Exits 1 when any section regressed, 2 on bad input, 0 otherwise.
+//
+// Mean, spread and call count all describe the timed calls as measured: sampledTime / sampledCount,
+// stdDevTime and sampledCount, with no extrapolation or overhead compensation. Baselines written
+// before sampledTime existed fall back to averageTime for the mean, and those before stdDevTime to a
+// spread estimated from the histogram percentiles, (p90 - p50) / 1.2816, which is exact for
+// normally distributed call times.
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+    // Just enough JSON for the profiler's own output
+    struct JsonValue {
+        enum Type { Null, Bool, Number, String, Array, Object } type = Null;
+        double number = 0.0;
+        std::string text;
+        std::vector<JsonValue> items;
+        std::vector<std::pair<std::string, JsonValue>> members;
+
+        JsonValue const* Find(const char* key) const
+        {
+            for (auto const& member: members) {
+                if (member.first == key) {
+                    return &member.second;
+                }
+            }
+            return nullptr;
+        }
+
+        double NumberOr(const char* key, double fallback) const
+        {
+            JsonValue const* value = Find(key);
+            return (value && value->type == Number) ? value->number : fallback;
+        }
+    };
+
+    class JsonParser {
+        public:
+            JsonParser(std::string const& text) : position(0), text(text) {}
+
+            bool Parse(JsonValue& value)
+            {
+                if (!ParseValue(value)) {
+                    return false;
+                }
+                SkipSpace();
+                return position == text.size();
+            }
+
+            size_t position;
+
+        private:
+            void SkipSpace()
+            {
+                while (position < text.size() && isspace((unsigned char)text[position])) {
+                    ++position;
+                }
+            }
+
+            bool Consume(const char* literal)
+            {
+                size_t length = strlen(literal);
+                if (text.compare(position, length, literal) != 0) {
+                    return false;
+                }
+                position += length;
+                return true;
+            }
+
+            bool ParseString(std::string& out)
+            {
+                if (text[position] != '"') {
+                    return false;
+                }
+                ++position;
+                while (position < text.size() && text[position] != '"') {
+                    char c = text[position++];
+                    if (c == '\\' && position < text.size()) {
+                        char escaped = text[position++];
+                        switch (escaped) {
+                            case 'n': out += '\n'; break;
+                            case 't': out += '\t'; break;
+                            case 'r': out += '\r'; break;
+                            case 'b': out += '\b'; break;
+                            case 'f': out += '\f'; break;
+                            case 'u': out += '?'; position += 4; break; // Section names are ASCII in practice
+                            default: out += escaped; break;
+                        }
+                    } else {
+                        out += c;
+                    }
+                }
+                if (position >= text.size()) {
+                    return false;
+                }
+                ++position;
+                return true;
+            }
+
+            bool ParseValue(JsonValue& value)
+            {
+                SkipSpace();
+                if (position >= text.size()) {
+                    return false;
+                }
+                char c = text[position];
+                if (c == '{') {
+                    value.type = JsonValue::Object;
+                    ++position;
+                    SkipSpace();
+                    if (position < text.size() && text[position] == '}') {
+                        ++position;
+                        return true;
+                    }
+                    while (true) {
+                        SkipSpace();
+                        std::string key;
+                        if (!ParseString(key)) {
+                            return false;
+                        }
+                        SkipSpace();
+                        if (!Consume(":")) {
+                            return false;
+                        }
+                        value.members.emplace_back(key, JsonValue());
+                        if (!ParseValue(value.members.back().second)) {
+                            return false;
+                        }
+                        SkipSpace();
+                        if (Consume("}")) {
+                            return true;
+                        }
+                        if (!Consume(",")) {
+                            return false;
+                        }
+                    }
+                }
+                if (c == '[') {
+                    value.type = JsonValue::Array;
+                    ++position;
+                    SkipSpace();
+                    if (position < text.size() && text[position] == ']') {
+                        ++position;
+                        return true;
+                    }
+                    while (true) {
+                        value.items.emplace_back();
+                        if (!ParseValue(value.items.back())) {
+                            return false;
+                        }
+                        SkipSpace();
+                        if (Consume("]")) {
+                            return true;
+                        }
+                        if (!Consume(",")) {
+                            return false;
+                        }
+                    }
+                }
+                if (c == '"') {
+                    value.type = JsonValue::String;
+                    return ParseString(value.text);
+                }
+                if (Consume("true")) {
+                    value.type = JsonValue::Bool;
+                    value.number = 1.0;
+                    return true;
+                }
+                if (Consume("false")) {
+                    value.type = JsonValue::Bool;
+                    return true;
+                }
+                if (Consume("null")) {
+                    value.type = JsonValue::Null;
+                    return true;
+                }
+                char* end = nullptr;
+                value.number = strtod(text.c_str() + position, &end);
+                if (end == text.c_str() + position) {
+                    return false;
+                }
+                value.type = JsonValue::Number;
+                position = end - text.c_str();
+                return true;
+            }
+
+            std::string const& text;
+    };
+
+    // Timed calls of every section with one name, pooled when several call sites share it
+    struct SectionSample {
+        double calls = 0.0;     // Timed calls, the t-test's sample size
+        double mean = 0.0;      // Seconds per call
+        double variance = 0.0;  // Seconds squared
+    };
+
+    bool LoadSections(const char* fileName, std::map<std::string, SectionSample>& sections)
+    {
+        std::ifstream file(fileName);
+        if (!file.is_open()) {
+            fprintf(stderr, "Error: Unable to open %s\n", fileName);
+            return false;
+        }
+        std::stringstream buffer;
+        buffer << file.rdbuf();
+        std::string text = buffer.str();
+
+        JsonValue root;
+        JsonParser parser(text);
+        if (!parser.Parse(root) || root.type != JsonValue::Object) {
+            fprintf(stderr, "Error: %s is not valid JSON (stopped at byte %zu)\n", fileName, parser.position);
+            return false;
+        }
+        JsonValue const* list = root.Find("sections");
+        if (!list || list->type != JsonValue::Array) {
+            fprintf(stderr, "Error: %s has no \"sections\" array; is it a profiler_stats.json?\n", fileName);
+            return false;
+        }
+
+        for (JsonValue const& section: list->items) {
+            JsonValue const* name = section.Find("sectionName");
+            if (!name || name->type != JsonValue::String) {
+                continue;
+            }
+            double count = section.NumberOr("count", 0.0);
+            double calls = section.NumberOr("sampledCount", count);
+            if (calls <= 0.0) {
+                continue;
+            }
+            // The file is in milliseconds
+            double sampledTime = section.NumberOr("sampledTime", -1.0);
+            double mean = 1e-3 * (sampledTime >= 0.0 ? sampledTime / calls : section.NumberOr("averageTime", 0.0));
+            double spread = section.NumberOr("stdDevTime", -1.0);
+            if (spread < 0.0) {
+                spread = std::max(0.0, section.NumberOr("p90Time", 0.0) - section.NumberOr("p50Time", 0.0)) / 1.2816;
+            }
+            double variance = 1e-6 * spread * spread;
+
+            // Pool with an earlier entry of the same name through the combined sums of squares
+            SectionSample& pooled = sections[name->text];
+            double total = pooled.calls + calls;
+            double combinedMean = (pooled.calls * pooled.mean + calls * mean) / total;
+            double squares = (pooled.calls - 1.0) * pooled.variance + pooled.calls * pooled.mean * pooled.mean
+                           + (calls - 1.0) * variance + calls * mean * mean;
+            pooled.variance = (total > 1.0) ? std::max(0.0, (squares - total * combinedMean * combinedMean) / (total - 1.0)) : 0.0;
+            pooled.mean = combinedMean;
+            pooled.calls = total;
+        }
+        return true;
+    }
+
+    // Continued fraction for the regularized incomplete beta function (modified Lentz)
+    double IncompleteBetaFraction(double a, double b, double x)
+    {
+        const double tiny = 1e-300;
+        double c = 1.0;
+        double d = 1.0 - (a + b) * x / (a + 1.0);
+        d = 1.0 / (std::fabs(d) < tiny ? tiny : d);
+        double result = d;
+        for (int m = 1; m <= 300; ++m) {
+            double m2 = 2.0 * m;
+            double numerator = m * (b - m) * x / ((a + m2 - 1.0) * (a + m2));
+            d = 1.0 + numerator * d;
+            c = 1.0 + numerator / c;
+            d = 1.0 / (std::fabs(d) < tiny ? tiny : d);
+            c = std::fabs(c) < tiny ? tiny : c;
+            result *= d * c;
+            numerator = -(a + m) * (a + b + m) * x / ((a + m2) * (a + m2 + 1.0));
+            d = 1.0 + numerator * d;
+            c = 1.0 + numerator / c;
+            d = 1.0 / (std::fabs(d) < tiny ? tiny : d);
+            c = std::fabs(c) < tiny ? tiny : c;
+            double step = d * c;
+            result *= step;
+            if (std::fabs(step - 1.0) < 1e-12) {
+                break;
+            }
+        }
+        return result;
+    }
+
+    double RegularizedIncompleteBeta(double a, double b, double x)
+    {
+        if (x <= 0.0) {
+            return 0.0;
+        }
+        if (x >= 1.0) {
+            return 1.0;
+        }
+        double front = std::exp(std::lgamma(a + b) - std::lgamma(a) - std::lgamma(b) + a * std::log(x) + b * std::log(1.0 - x));
+        if (x < (a + 1.0) / (a + b + 2.0)) {
+            return front * IncompleteBetaFraction(a, b, x) / a;
+        }
+        return 1.0 - front * IncompleteBetaFraction(b, a, 1.0 - x) / b;
+    }
+
+    // Two-sided p-value of Welch's t-test for a difference in means
+    double WelchPValue(SectionSample const& before, SectionSample const& after, double& t)
+    {
+        double errorBefore = before.variance / before.calls;
+        double errorAfter = after.variance / after.calls;
+        double standardError = std::sqrt(errorBefore + errorAfter);
+        if (standardError <= 0.0) {
+            t = 0.0;
+            return (after.mean == before.mean) ? 1.0 : 0.0; // No spread at all: any difference is real
+        }
+        t = (after.mean - before.mean) / standardError;
+        double degrees = (errorBefore + errorAfter) * (errorBefore + errorAfter)
+                       / (errorBefore * errorBefore / (before.calls - 1.0) + errorAfter * errorAfter / (after.calls - 1.0));
+        return RegularizedIncompleteBeta(0.5 * degrees, 0.5, degrees / (degrees + t * t));
+    }
+
+    struct Comparison {
+        std::string name;
+        SectionSample before;
+        SectionSample after;
+        double change;   // Relative change of the mean, +0.1 is 10% slower
+        double t;
+        double p;
+        const char* verdict;
+    };
+}
+
+int main(int argc, char** argv)
+{
+    const char* baselineFile = nullptr;
+    const char* currentFile = nullptr;
+    double thresholdPercent = 10.0;
+    double alpha = 0.01;
+    double minCalls = 2.0;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+            thresholdPercent = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--alpha") == 0 && i + 1 < argc) {
+            alpha = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--min-calls") == 0 && i + 1 < argc) {
+            minCalls = std::max(2.0, atof(argv[++i]));
+        } else if (argv[i][0] != '-' && !baselineFile) {
+            baselineFile = argv[i];
+        } else if (argv[i][0] != '-' && !currentFile) {
+            currentFile = argv[i];
+        } else {
+            baselineFile = nullptr;
+            break;
+        }
+    }
+    if (!baselineFile || !currentFile) {
+        fprintf(stderr, "Usage: %s baseline.json current.json [--threshold 10] [--alpha 0.01] [--min-calls 2]\n", argv[0]);
+        return 2;
+    }
+
+    std::map<std::string, SectionSample> baseline, current;
+    if (!LoadSections(baselineFile, baseline) || !LoadSections(currentFile, current)) {
+        return 2;
+    }
+
+    std::vector<Comparison> comparisons;
+    int regressions = 0;
+    for (auto const& entry: current) {
+        Comparison comparison;
+        comparison.name = entry.first;
+        comparison.after = entry.second;
+        comparison.change = 0.0;
+        comparison.t = 0.0;
+        comparison.p = 1.0;
+        auto base = baseline.find(entry.first);
+        if (base == baseline.end()) {
+            comparison.verdict = "new";
+        } else {
+            comparison.before = base->second;
+            comparison.change = (comparison.before.mean > 0.0) ? comparison.after.mean / comparison.before.mean - 1.0 : 0.0;
+            if (comparison.before.calls < minCalls || comparison.after.calls < minCalls) {
+                comparison.verdict = "too few calls";
+            } else {
+                comparison.p = WelchPValue(comparison.before, comparison.after, comparison.t);
+                bool significant = comparison.p < alpha;
+                if (significant && comparison.change > 0.01 * thresholdPercent) {
+                    comparison.verdict = "REGRESSED";
+                    ++regressions;
+                } else if (significant && comparison.change < -0.01 * thresholdPercent) {
+                    comparison.verdict = "improved";
+                } else {
+                    comparison.verdict = significant ? "within threshold" : "no significant change";
+                }
+            }
+        }
+        comparisons.push_back(comparison);
+    }
+    for (auto const& entry: baseline) {
+        if (current.find(entry.first) == current.end()) {
+            Comparison comparison;
+            comparison.name = entry.first;
+            comparison.before = entry.second;
+            comparison.change = 0.0;
+            comparison.t = 0.0;
+            comparison.p = 1.0;
+            comparison.verdict = "removed";
+            comparisons.push_back(comparison);
+        }
+    }
+
+    // Worst slowdowns first; ties keep the name order of the map, so reruns print the same table
+    std::stable_sort(comparisons.begin(), comparisons.end(), [](Comparison const& a, Comparison const& b) {
+        return a.change > b.change;
+    });
+
+    printf("Baseline %s, current %s: regression is > %.1f%% slower with p < %g\n", baselineFile, currentFile, thresholdPercent, alpha);
+    printf("%-32s %10s %12s %10s %12s %12s %9s %8s %10s  %s\n", "section", "base calls", "base avg ms", "calls",
+           "avg ms", "stddev ms", "change", "t", "p", "verdict");
+    for (Comparison const& c: comparisons) {
+        printf("%-32.32s %10.0f %12.06f %10.0f %12.06f %12.06f %8.1f%% %8.2f %10.2e  %s\n", c.name.c_str(), c.before.calls,
+               1000.0 * c.before.mean, c.after.calls, 1000.0 * c.after.mean, 1000.0 * std::sqrt(c.after.variance),
+               100.0 * c.change, c.t, c.p, c.verdict);
+    }
+    printf("%d of %zu sections regressed.\n", regressions, comparisons.size());
+    return regressions > 0 ? 1 : 0;
+}
@@ -0,0 +1,103 @@
+// Polls the live stats a running profiler publishes to shared memory and prints them as a table,
+// with call rates measured between polls. Build with `make live`.
+//
+//   ./profiler_live (--pid PID | --name /profiler_live.PID) [--interval-ms 500] [--count N]
+//
+// --pid finds the region a process published under the default name. --count 0 (the default) polls
+// until the profiled process exits.
+
+#include "live_stats.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <thread>
+
+#include <signal.h>
+
+namespace {
+    bool ProcessAlive(uint32_t processId)
+    {
+        return kill((pid_t)processId, 0) == 0;
+    }
+
+    void PrintTable(LiveStatsCopy const& copy, std::map<int, uint64_t> const& previousCounts, double elapsedSeconds)
+    {
+        std::vector<LiveSectionRecord> sections = copy.sections;
+        std::sort(sections.begin(), sections.end(), [](LiveSectionRecord const& a, LiveSectionRecord const& b) {
+            return a.totalTime > b.totalTime;
+        });
+
+        printf("pid %u, publish #%llu at %.03fs (every %.0fms)\n", copy.processId,
+               (unsigned long long)copy.publishCount, copy.publishTime, 1000.0 * copy.intervalSeconds);
+        printf("%-32s %12s %12s %12s %12s %12s %12s\n", "section", "calls", "calls/s", "total ms", "avg ms", "p99 ms", "max ms");
+        for (LiveSectionRecord const& section: sections) {
+            double rate = 0.0;
+            auto previous = previousCounts.find(section.sectionId);
+            if (previous != previousCounts.end() && elapsedSeconds > 0.0) {
+                rate = double(section.count - previous->second) / elapsedSeconds;
+            }
+            printf("%-32.32s %12llu %12.0f %12.03f %12.06f %12.06f %12.06f\n", section.sectionName,
+                   (unsigned long long)section.count, rate, 1000.0 * section.totalTime, 1000.0 * section.avgTime,
+                   1000.0 * section.p99Time, 1000.0 * section.maxTime);
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    std::string name;
+    int intervalMs = 500;
+    long count = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--name") == 0 && i + 1 < argc) {
+            name = argv[++i];
+        } else if (strcmp(argv[i], "--pid") == 0 && i + 1 < argc) {
+            name = LIVE_STATS_NAME_PREFIX + std::string(argv[++i]);
+        } else if (strcmp(argv[i], "--interval-ms") == 0 && i + 1 < argc) {
+            intervalMs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--count") == 0 && i + 1 < argc) {
+            count = atol(argv[++i]);
+        } else {
+            name.clear();
+            break;
+        }
+    }
+    if (name.empty()) { // Unknown argument, or no region given
+        fprintf(stderr, "Usage: %s (--pid PID | --name /profiler_live.PID) [--interval-ms 500] [--count N]\n", argv[0]);
+        return 1;
+    }
+
+    LiveStatsReader reader;
+    if (!reader.Open(name.c_str())) {
+        return 1;
+    }
+
+    LiveStatsCopy copy = LiveStatsCopy();
+    std::map<int, uint64_t> previousCounts;
+    double previousTime = 0.0;
+    for (long poll = 0; count == 0 || poll < count; ++poll) {
+        if (!reader.Read(copy)) {
+            fprintf(stderr, "Error: The publisher kept the table busy; skipping this poll.\n");
+        } else {
+            PrintTable(copy, previousCounts, copy.publishTime - previousTime);
+            previousCounts.clear();
+            for (LiveSectionRecord const& section: copy.sections) {
+                previousCounts[section.sectionId] = section.count;
+            }
+            previousTime = copy.publishTime;
+        }
+        if (!ProcessAlive(copy.processId)) {
+            printf("Process %u has exited.\n", copy.processId);
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(intervalMs));
+    }
+    return 0;
+}
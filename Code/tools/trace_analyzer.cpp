@@ -0,0 +1,512 @@
+// Summarizes a binary trace (see trace_format.hpp) without the process that recorded it: per-section
+// stats with percentiles, the merged call tree and a per-thread breakdown, written as JSON in the
+// same shape as Profiler::printStatsToJSON so visualize_profiler.py can load it. Build with
+// `make analyzer`.
+//
+//   ./trace_analyzer profiler_trace.bin [-o trace_summary.json] [--jobs N]
+//
+// The trace is memory-mapped and never copied. Each recorded thread's events are cut into slices
+// at top-level calls, the slices are analyzed by a pool of workers and the results are merged, so
+// one busy thread still spreads over the cores unless a single call spans all of it.
+// Traces hold timed calls only, so sections under a sampling policy show their sampled calls.
+
+#include "histogram.hpp"
+#include "trace_export.hpp"
+#include "trace_reader.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+    struct SectionSummary {
+        uint64_t count = 0;
+        uint64_t totalTicks = 0;
+        uint64_t exclusiveTicks = 0;
+        uint64_t minTicks = UINT64_MAX;
+        uint64_t maxTicks = 0;
+        uint64_t firstStartTicks = UINT64_MAX;
+        uint64_t lastStopTicks = 0;
+        LatencyHistogram histogram;
+
+        void Merge(SectionSummary const& other)
+        {
+            count += other.count;
+            totalTicks += other.totalTicks;
+            exclusiveTicks += other.exclusiveTicks;
+            minTicks = std::min(minTicks, other.minTicks);
+            maxTicks = std::max(maxTicks, other.maxTicks);
+            firstStartTicks = std::min(firstStartTicks, other.firstStartTicks);
+            lastStopTicks = std::max(lastStopTicks, other.lastStopTicks);
+            histogram.Merge(other.histogram);
+        }
+    };
+
+    // The sections one thread or slice ran, stored densely in first-seen order so a thread that runs
+    // a few of the trace's sections does not carry a histogram for every one
+    struct SectionTable {
+        std::vector<int> slots;                        // sectionId -> index into summaries, -1 if not run
+        std::vector<int> sectionIds;                   // Parallel to summaries
+        std::vector<SectionSummary> summaries;
+
+        SectionSummary& Get(int sectionId)
+        {
+            if ((size_t)sectionId >= slots.size()) {
+                slots.resize((size_t)sectionId + 1, -1);
+            }
+            int& slot = slots[sectionId];
+            if (slot == -1) {
+                slot = (int)summaries.size();
+                sectionIds.push_back(sectionId);
+                summaries.emplace_back();
+            }
+            return summaries[slot];
+        }
+
+        void Merge(SectionTable const& other)
+        {
+            for (size_t i = 0; i < other.summaries.size(); ++i) {
+                Get(other.sectionIds[i]).Merge(other.summaries[i]);
+            }
+        }
+    };
+
+    // Same flat, index-linked layout as the Profiler's call tree; node 0 is the root
+    struct TreeNode {
+        int sectionId;
+        int parent;
+        int firstChild = -1;
+        int lastChild = -1;
+        int nextSibling = -1;
+        uint64_t count = 0;
+        uint64_t inclusiveTicks = 0;
+
+        TreeNode(int sectionId, int parent) : sectionId(sectionId), parent(parent) {}
+    };
+
+    struct CallTree {
+        std::vector<TreeNode> nodes;
+        std::unordered_map<uint64_t, int> children;   // parent << 32 | sectionId -> child node
+
+        CallTree() { nodes.emplace_back(-1, -1); }
+
+        // As ThreadProfilerData::GetChildNode: the repeated-child fast path, then a hash, never a sibling walk
+        int GetChild(int parent, int sectionId)
+        {
+            int first = nodes[parent].firstChild;
+            if (first != -1 && nodes[first].sectionId == sectionId) {
+                return first;
+            }
+            uint64_t key = ((uint64_t)parent << 32) | (uint32_t)sectionId;
+            auto found = children.find(key);
+            if (found != children.end()) {
+                return found->second;
+            }
+            int child = (int)nodes.size();
+            nodes.emplace_back(sectionId, parent);
+            if (first == -1) {
+                nodes[parent].firstChild = child;
+            } else {
+                nodes[nodes[parent].lastChild].nextSibling = child;
+            }
+            nodes[parent].lastChild = child;
+            children.emplace(key, child);
+            return child;
+        }
+
+        void Merge(CallTree const& other, int otherNode, int node)
+        {
+            for (int child = other.nodes[otherNode].firstChild; child != -1; child = other.nodes[child].nextSibling) {
+                int merged = GetChild(node, other.nodes[child].sectionId);
+                nodes[merged].count += other.nodes[child].count;
+                nodes[merged].inclusiveTicks += other.nodes[child].inclusiveTicks;
+                Merge(other, child, merged);
+            }
+        }
+
+        uint64_t ExclusiveTicks(int node) const
+        {
+            uint64_t childTicks = 0;
+            for (int child = nodes[node].firstChild; child != -1; child = nodes[child].nextSibling) {
+                childTicks += nodes[child].inclusiveTicks;
+            }
+            return nodes[node].inclusiveTicks > childTicks ? nodes[node].inclusiveTicks - childTicks : 0;
+        }
+    };
+
+    struct ThreadSummary {
+        uint32_t threadIndex = 0;
+        uint64_t eventCount = 0;
+        std::vector<TraceChunkHeader const*> chunks;   // Sorted by sequence, so events are in exit order
+        std::vector<uint64_t> chunkStarts;             // Position of each chunk's first event, then the total
+        SectionTable sections;
+        CallTree callTree;
+
+        // Chunk holding the event at position, a thread-wide index in exit order
+        size_t ChunkOf(uint64_t position) const
+        {
+            return (size_t)(std::upper_bound(chunkStarts.begin(), chunkStarts.end(), position) - chunkStarts.begin()) - 1;
+        }
+    };
+
+    // A run of one thread's events made of whole top-level calls, analyzed by one worker
+    struct WorkSlice {
+        size_t thread;
+        uint64_t begin;                                // Event positions in the thread's exit order
+        uint64_t end;
+        uint64_t eventCount = 0;
+        SectionTable sections;
+        CallTree callTree;
+    };
+
+    struct OpenCall {
+        uint64_t startTicks;
+        uint64_t endTicks;
+        int node;
+    };
+
+    // Cuts a thread's events into slices of about sliceEvents. Each slice ends just after a
+    // top-level call (depth 0, so nothing enclosed it, sampled or not), so no call is split from
+    // its children and every slice can be walked from an empty stack.
+    void SliceThread(ThreadSummary const& thread, size_t threadSlot, uint64_t sliceEvents, std::vector<WorkSlice>& slices)
+    {
+        uint64_t total = thread.chunkStarts.back();
+        for (uint64_t begin = 0; begin < total;) {
+            uint64_t end = std::min(begin + sliceEvents, total);
+            size_t chunk = thread.ChunkOf(end - 1);
+            while (end < total && TraceReader::GetEvents(thread.chunks[chunk])[end - 1 - thread.chunkStarts[chunk]].depth != 0) {
+                ++end;
+                while (end - 1 >= thread.chunkStarts[chunk + 1]) {
+                    ++chunk; // Also steps over empty chunks
+                }
+            }
+            slices.emplace_back();
+            slices.back().thread = threadSlot;
+            slices.back().begin = begin;
+            slices.back().end = end;
+            begin = end;
+        }
+    }
+
+    // A thread's events are in exit order, i.e. a post-order walk of its calls. Walking them
+    // backwards visits every parent before its children, so a stack of the calls that contain the
+    // current event gives its path. Containment rather than the recorded depth is used, so calls
+    // whose parent was not sampled attach to the nearest recorded ancestor.
+    void AnalyzeSlice(WorkSlice& slice, ThreadSummary const& thread, size_t sectionCount)
+    {
+        std::vector<OpenCall> stack;
+        uint64_t position = slice.end;
+        for (size_t chunk = thread.ChunkOf(slice.end - 1); position > slice.begin; --chunk) {
+            TraceEvent const* events = TraceReader::GetEvents(thread.chunks[chunk]);
+            uint64_t chunkBegin = std::max(thread.chunkStarts[chunk], slice.begin);
+            for (; position > chunkBegin; --position) {
+                TraceEvent const& event = events[position - 1 - thread.chunkStarts[chunk]];
+                if (event.sectionId < 0 || (size_t)event.sectionId >= sectionCount) {
+                    continue;
+                }
+                while (!stack.empty() && !(stack.back().startTicks <= event.startTicks && event.endTicks <= stack.back().endTicks)) {
+                    stack.pop_back();
+                }
+                int parent = stack.empty() ? 0 : stack.back().node;
+                int node = slice.callTree.GetChild(parent, event.sectionId);
+                uint64_t elapsedTicks = event.endTicks - event.startTicks;
+                slice.callTree.nodes[node].count++;
+                slice.callTree.nodes[node].inclusiveTicks += elapsedTicks;
+                stack.push_back({ event.startTicks, event.endTicks, node });
+
+                SectionSummary& section = slice.sections.Get(event.sectionId);
+                section.count++;
+                section.totalTicks += elapsedTicks;
+                section.minTicks = std::min(section.minTicks, elapsedTicks);
+                section.maxTicks = std::max(section.maxTicks, elapsedTicks);
+                section.firstStartTicks = std::min(section.firstStartTicks, event.startTicks);
+                section.lastStopTicks = std::max(section.lastStopTicks, event.endTicks);
+                section.histogram.Record(elapsedTicks);
+                slice.eventCount++;
+            }
+        }
+        // Exclusive time adds up across slices, as no call straddles two
+        for (size_t node = 1; node < slice.callTree.nodes.size(); ++node) {
+            slice.sections.Get(slice.callTree.nodes[node].sectionId).exclusiveTicks += slice.callTree.ExclusiveTicks((int)node);
+        }
+    }
+
+    class SummaryWriter {
+        public:
+            SummaryWriter(TraceReader const& reader, std::ofstream& file)
+                : reader(reader), file(file), secondsPerTick(reader.GetHeader().secondsPerTick) {}
+
+            double Ms(uint64_t ticks) const { return 1000.0 * secondsPerTick * double(ticks); }
+
+            void WriteSection(int sectionId, SectionSummary const& s, const char* parentSection)
+            {
+                TraceSection const* info = (size_t)sectionId < reader.GetSections().size() ? &reader.GetSections()[sectionId] : nullptr;
+                uint64_t clockStart = reader.GetHeader().clockStartTicks;
+                file << "    {\n"
+                     << "      \"sectionName\": \"" << EscapeJSON(reader.GetSectionName(sectionId)) << "\",\n"
+                     << "      \"count\": " << s.count << ",\n"
+                     << "      \"totalTime\": " << Ms(s.totalTicks) << ",\n"
+                     << "      \"exclusiveTime\": " << Ms(s.exclusiveTicks) << ",\n"
+                     << "      \"minTime\": " << Ms(s.minTicks) << ",\n"
+                     << "      \"maxTime\": " << Ms(s.maxTicks) << ",\n"
+                     << "      \"averageTime\": " << (Ms(s.totalTicks) / double(s.count)) << ",\n";
+                double percentiles[4] = { 0.5, 0.9, 0.99, 0.999 };
+                const char* names[4] = { "p50Time", "p90Time", "p99Time", "p999Time" };
+                for (int i = 0; i < 4; ++i) {
+                    uint64_t ticks = std::min(std::max(s.histogram.Percentile(percentiles[i]), s.minTicks), s.maxTicks);
+                    file << "      \"" << names[i] << "\": " << Ms(ticks) << ",\n";
+                }
+                file << "      \"startTime\": " << Ms(s.firstStartTicks - clockStart) << ",\n"
+                     << "      \"endTime\": " << Ms(s.lastStopTicks - clockStart) << ",\n"
+                     << "      \"parentSection\": ";
+                if (parentSection) {
+                    file << "\"" << EscapeJSON(parentSection) << "\",\n";
+                } else {
+                    file << "null,\n";
+                }
+                file << "      \"fileName\": \"" << EscapeJSON(info && !info->fileName.empty() ? info->fileName : "N/A") << "\",\n"
+                     << "      \"functionName\": \"" << EscapeJSON(info && !info->functionName.empty() ? info->functionName : "N/A") << "\",\n"
+                     << "      \"lineNumber\": " << (info ? info->lineNumber : 0) << "\n"
+                     << "    }";
+            }
+
+            void WriteCallTreeNode(CallTree const& tree, int node, int depth)
+            {
+                TreeNode const& n = tree.nodes[node];
+                std::string indent(2 * depth, ' ');
+                file << indent << "{\n"
+                     << indent << "  \"sectionName\": \"" << EscapeJSON(reader.GetSectionName(n.sectionId)) << "\",\n"
+                     << indent << "  \"count\": " << n.count << ",\n"
+                     << indent << "  \"inclusiveTime\": " << Ms(n.inclusiveTicks) << ",\n"
+                     << indent << "  \"exclusiveTime\": " << Ms(tree.ExclusiveTicks(node)) << ",\n"
+                     << indent << "  \"children\": [";
+                for (int child = n.firstChild; child != -1; child = tree.nodes[child].nextSibling) {
+                    file << "\n";
+                    WriteCallTreeNode(tree, child, depth + 2);
+                    if (tree.nodes[child].nextSibling != -1) {
+                        file << ",";
+                    }
+                }
+                file << (n.firstChild == -1 ? "]\n" : "\n" + indent + "  ]\n");
+                file << indent << "}";
+            }
+
+        private:
+            TraceReader const& reader;
+            std::ofstream& file;
+            double secondsPerTick;
+    };
+
+    bool WriteSummary(const char* traceFileName, const char* fileName, TraceReader const& reader,
+                      std::vector<ThreadSummary> const& threads, std::vector<SectionSummary> const& sections, CallTree const& tree)
+    {
+        std::ofstream file(fileName);
+        if (!file.is_open()) {
+            std::cerr << "Error: Unable to open file " << fileName << std::endl;
+            return false;
+        }
+        SummaryWriter writer(reader, file);
+        TraceFileHeader const& header = reader.GetHeader();
+
+        // A section's parent is the one it spends the most time under, as in the Profiler's report
+        std::vector<int> parentNode(sections.size(), -1);
+        std::vector<uint64_t> parentTicks(sections.size(), 0);
+        for (size_t node = 1; node < tree.nodes.size(); ++node) {
+            TreeNode const& n = tree.nodes[node];
+            if (parentNode[n.sectionId] == -1 || n.inclusiveTicks > parentTicks[n.sectionId]) {
+                parentNode[n.sectionId] = n.parent;
+                parentTicks[n.sectionId] = n.inclusiveTicks;
+            }
+        }
+
+        file << "{\n"
+             << "  \"trace\": {\n"
+             << "    \"fileName\": \"" << EscapeJSON(traceFileName) << "\",\n"
+             << "    \"events\": " << reader.GetEventCount() << ",\n"
+             << "    \"threads\": " << threads.size() << ",\n"
+             << "    \"droppedEvents\": " << header.droppedEvents << ",\n"
+             << "    \"complete\": " << (header.sectionTableOffset ? "true" : "false") << "\n"
+             << "  },\n";
+
+        file << "  \"sections\": [";
+        bool first = true;
+        for (size_t id = 0; id < sections.size(); ++id) {
+            if (sections[id].count == 0) {
+                continue;
+            }
+            file << (first ? "\n" : ",\n");
+            first = false;
+            const char* parent = parentNode[id] > 0 ? reader.GetSectionName(tree.nodes[parentNode[id]].sectionId) : nullptr;
+            writer.WriteSection((int)id, sections[id], parent);
+        }
+        file << (first ? "],\n" : "\n  ],\n");
+
+        file << "  \"threads\": [";
+        for (size_t t = 0; t < threads.size(); ++t) {
+            ThreadSummary const& thread = threads[t];
+            file << (t == 0 ? "\n" : ",\n")
+                 << "    {\n"
+                 << "      \"threadIndex\": " << thread.threadIndex << ",\n"
+                 << "      \"events\": " << thread.eventCount << ",\n"
+                 << "      \"sections\": [";
+            std::vector<int> ids = thread.sections.sectionIds;
+            std::sort(ids.begin(), ids.end());
+            bool firstSection = true;
+            for (int id: ids) {
+                SectionSummary const& s = thread.sections.summaries[thread.sections.slots[id]];
+                file << (firstSection ? "\n" : ",\n")
+                     << "        { \"sectionName\": \"" << EscapeJSON(reader.GetSectionName(id)) << "\", \"count\": " << s.count
+                     << ", \"totalTime\": " << writer.Ms(s.totalTicks) << ", \"exclusiveTime\": " << writer.Ms(s.exclusiveTicks) << " }";
+                firstSection = false;
+            }
+            file << (firstSection ? "]\n" : "\n      ]\n") << "    }";
+        }
+        file << (threads.empty() ? "],\n" : "\n  ],\n");
+
+        file << "  \"callTree\": [";
+        for (int child = tree.nodes[0].firstChild; child != -1; child = tree.nodes[child].nextSibling) {
+            file << "\n";
+            writer.WriteCallTreeNode(tree, child, 2);
+            if (tree.nodes[child].nextSibling != -1) {
+                file << ",";
+            }
+        }
+        file << (tree.nodes[0].firstChild == -1 ? "]\n" : "\n  ]\n");
+        file << "}\n";
+        return true;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const char* traceFileName = nullptr;
+    const char* outputFileName = "trace_summary.json";
+    unsigned jobs = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            outputFileName = argv[++i];
+        } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+            jobs = (unsigned)std::max(1, atoi(argv[++i]));
+        } else if (!traceFileName && argv[i][0] != '-') {
+            traceFileName = argv[i];
+        } else {
+            traceFileName = nullptr;
+            break;
+        }
+    }
+    if (!traceFileName) {
+        fprintf(stderr, "Usage: %s trace.bin [-o trace_summary.json] [--jobs N]\n", argv[0]);
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    TraceReader reader;
+    if (!reader.Open(traceFileName)) {
+        return 1;
+    }
+
+    // Group chunks by recording thread, in the order that thread filled them
+    std::map<uint32_t, size_t> threadSlots;
+    std::vector<ThreadSummary> threads;
+    for (TraceChunkHeader const* chunk: reader.GetChunks()) {
+        auto slot = threadSlots.find(chunk->threadIndex);
+        if (slot == threadSlots.end()) {
+            slot = threadSlots.emplace(chunk->threadIndex, threads.size()).first;
+            threads.emplace_back();
+            threads.back().threadIndex = chunk->threadIndex;
+        }
+        threads[slot->second].chunks.push_back(chunk);
+    }
+    for (ThreadSummary& thread: threads) {
+        std::sort(thread.chunks.begin(), thread.chunks.end(), [](TraceChunkHeader const* a, TraceChunkHeader const* b) {
+            return a->sequence < b->sequence;
+        });
+        thread.chunkStarts.push_back(0);
+        for (TraceChunkHeader const* chunk: thread.chunks) {
+            thread.chunkStarts.push_back(thread.chunkStarts.back() + chunk->eventCount);
+        }
+    }
+
+    // A few slices per worker, so they even out when some threads are busier than others
+    uint64_t sliceEvents = std::max<uint64_t>(reader.GetEventCount() / (4 * jobs), 1 << 16);
+    std::vector<WorkSlice> slices;
+    for (size_t t = 0; t < threads.size(); ++t) {
+        SliceThread(threads[t], t, sliceEvents, slices);
+    }
+
+    // Largest slices first, so a long one (a top-level call with a big subtree) doesn't start last
+    std::vector<size_t> order(slices.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return slices[a].end - slices[a].begin > slices[b].end - slices[b].begin;
+    });
+
+    size_t sectionCount = std::max(reader.GetSections().size(), (size_t)1);
+    for (TraceChunkHeader const* chunk: reader.GetChunks()) {
+        TraceEvent const* events = TraceReader::GetEvents(chunk);
+        for (uint32_t i = 0; i < chunk->eventCount; ++i) {
+            // Traces cut short have no section table; size by the ids actually seen
+            if (events[i].sectionId >= 0 && (size_t)events[i].sectionId >= sectionCount) {
+                sectionCount = (size_t)events[i].sectionId + 1;
+            }
+        }
+        if (reader.GetHeader().sectionTableOffset) {
+            break; // Complete traces list every section, no need to scan
+        }
+    }
+
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> workers;
+    for (unsigned w = 0; w < std::min<size_t>(jobs, slices.size()); ++w) {
+        workers.emplace_back([&]() {
+            for (size_t i = next++; i < order.size(); i = next++) {
+                WorkSlice& slice = slices[order[i]];
+                AnalyzeSlice(slice, threads[slice.thread], sectionCount);
+            }
+        });
+    }
+    for (auto& worker: workers) {
+        worker.join();
+    }
+
+    // Latest slice first, as a single backward walk of the thread would have met them, so children
+    // keep the same first-seen order however the thread was cut
+    for (auto slice = slices.rbegin(); slice != slices.rend(); ++slice) {
+        ThreadSummary& thread = threads[slice->thread];
+        thread.sections.Merge(slice->sections);
+        thread.callTree.Merge(slice->callTree, 0, 0);
+        thread.eventCount += slice->eventCount;
+    }
+
+    std::vector<SectionSummary> sections(sectionCount);
+    CallTree tree;
+    for (ThreadSummary const& thread: threads) {
+        for (size_t i = 0; i < thread.sections.summaries.size(); ++i) {
+            sections[thread.sections.sectionIds[i]].Merge(thread.sections.summaries[i]);
+        }
+        tree.Merge(thread.callTree, 0, 0);
+    }
+
+    if (!WriteSummary(traceFileName, outputFileName, reader, threads, sections, tree)) {
+        return 1;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("Analyzed %llu events from %zu threads in %.03fs (%.1f M events/s); summary written to %s\n",
+           (unsigned long long)reader.GetEventCount(), threads.size(), seconds,
+           1e-6 * double(reader.GetEventCount()) / seconds, outputFileName);
+    if (reader.GetHeader().droppedEvents > 0) {
+        printf("Warning: the trace dropped %llu events; totals undercount.\n", (unsigned long long)reader.GetHeader().droppedEvents);
+    }
+    return 0;
+}
@@ -0,0 +1,180 @@
+#include "trace_export.hpp"
+
+#include "trace_reader.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+    // Buffered writer with hand-rolled number formatting; printf-style formatting would
+    // dominate the export time for tens of millions of events.
+    class JsonBuffer {
+        public:
+            explicit JsonBuffer(FILE* file) : file(file), buffer(1 << 20), used(0) {}
+            ~JsonBuffer() { Flush(); }
+
+            void Append(const char* text, size_t length)
+            {
+                if (used + length > buffer.size())
+                {
+                    Flush();
+                }
+                if (length > buffer.size())
+                {
+                    fwrite(text, 1, length, file);
+                    return;
+                }
+                memcpy(buffer.data() + used, text, length);
+                used += length;
+            }
+            void Append(const char* text) { Append(text, strlen(text)); }
+            void Append(std::string const& text) { Append(text.data(), text.size()); }
+
+            void AppendUnsigned(uint64_t value)
+            {
+                if (used + 24 > buffer.size())
+                {
+                    Flush();
+                }
+                char digits[24];
+                int count = 0;
+                do
+                {
+                    digits[count++] = char('0' + value % 10);
+                    value /= 10;
+                } while (value);
+                while (count)
+                {
+                    buffer[used++] = digits[--count];
+                }
+            }
+
+            // Nanoseconds as microseconds with three decimals, the unit Chrome traces use
+            void AppendMicroseconds(uint64_t nanoseconds)
+            {
+                AppendUnsigned(nanoseconds / 1000);
+                uint64_t fraction = nanoseconds % 1000;
+                char text[4] = { '.', char('0' + fraction / 100), char('0' + fraction / 10 % 10), char('0' + fraction % 10) };
+                Append(text, sizeof(text));
+            }
+
+            void Flush()
+            {
+                fwrite(buffer.data(), 1, used, file);
+                used = 0;
+            }
+
+        private:
+            FILE* file;
+            std::vector<char> buffer;
+            size_t used;
+    };
+}
+
+std::string EscapeJSON(std::string const& text)
+{
+    std::string escaped;
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+        {
+            escaped += '\\';
+            escaped += c;
+        }
+        else if ((unsigned char)c < 0x20)
+        {
+            char code[8];
+            snprintf(code, sizeof(code), "\\u%04x", (unsigned char)c);
+            escaped += code;
+        }
+        else
+        {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+bool ExportTraceToChromeJSON(const char* traceFileName, const char* jsonFileName)
+{
+    TraceReader reader;
+    if (!reader.Open(traceFileName))
+    {
+        return false;
+    }
+
+    FILE* file = fopen(jsonFileName, "wb");
+    if (!file)
+    {
+        std::cerr << "Error: Unable to open file " << jsonFileName << std::endl;
+        return false;
+    }
+
+    TraceFileHeader const& header = reader.GetHeader();
+    double nanosecondsPerTick = header.secondsPerTick * 1e9;
+
+    // Pre-escape each section's event prefix once instead of per event
+    std::vector<std::string> eventPrefixes;
+    for (TraceSection const& section : reader.GetSections())
+    {
+        eventPrefixes.push_back("{\"name\":\"" + EscapeJSON(section.sectionName) + "\",\"cat\":\"profiler\",\"ph\":\"X\",\"pid\":1,\"tid\":");
+    }
+    std::string unknownPrefix = "{\"name\":\"Unknown\",\"cat\":\"profiler\",\"ph\":\"X\",\"pid\":1,\"tid\":";
+
+    uint32_t threadCount = 0;
+    for (TraceChunkHeader const* chunk : reader.GetChunks())
+    {
+        if (chunk->threadIndex + 1 > threadCount)
+        {
+            threadCount = chunk->threadIndex + 1;
+        }
+    }
+
+    {
+        JsonBuffer out(file);
+        out.Append("{\"displayTimeUnit\":\"ns\",\"otherData\":{\"droppedEvents\":");
+        out.AppendUnsigned(header.droppedEvents);
+        out.Append("},\"traceEvents\":[\n");
+
+        // Thread names so the viewer labels tracks by profiler thread index
+        out.Append("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"Profiler\"}}");
+        for (uint32_t thread = 0; thread < threadCount; ++thread)
+        {
+            out.Append(",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":");
+            out.AppendUnsigned(thread);
+            out.Append(",\"args\":{\"name\":\"Thread ");
+            out.AppendUnsigned(thread);
+            out.Append("\"}}");
+        }
+
+        for (TraceChunkHeader const* chunk : reader.GetChunks())
+        {
+            TraceEvent const* events = TraceReader::GetEvents(chunk);
+            for (uint32_t i = 0; i < chunk->eventCount; ++i)
+            {
+                TraceEvent const& event = events[i];
+                uint64_t startTicks = event.startTicks > header.clockStartTicks ? event.startTicks - header.clockStartTicks : 0;
+                uint64_t durationTicks = event.endTicks > event.startTicks ? event.endTicks - event.startTicks : 0;
+
+                out.Append(",\n");
+                bool known = event.sectionId >= 0 && (size_t)event.sectionId < eventPrefixes.size();
+                out.Append(known ? eventPrefixes[event.sectionId] : unknownPrefix);
+                out.AppendUnsigned(chunk->threadIndex);
+                out.Append(",\"ts\":");
+                out.AppendMicroseconds((uint64_t)llround(double(startTicks) * nanosecondsPerTick));
+                out.Append(",\"dur\":");
+                out.AppendMicroseconds((uint64_t)llround(double(durationTicks) * nanosecondsPerTick));
+                out.Append("}");
+            }
+        }
+        out.Append("\n]}\n");
+    }
+
+    fclose(file);
+    std::cout << "Chrome trace with " << reader.GetEventCount() << " events written to " << jsonFileName << std::endl;
+    return true;
+}
@@ -0,0 +1,12 @@
+// include/trace_export.hpp
+#pragma once
+
+#include <string>
+
+// Converts a binary trace (see trace_format.hpp) to Chrome Trace Event JSON, loadable in
+// chrome://tracing, Perfetto (ui.perfetto.dev) or Speedscope. Every call becomes a complete ("X")
+// event on its recording thread's track, so nesting shows up from the timestamps alone.
+bool ExportTraceToChromeJSON(const char* traceFileName, const char* jsonFileName);
+
+// Quotes and backslashes escaped, control characters as \u00XX; for names written into any JSON output
+std::string EscapeJSON(std::string const& text);
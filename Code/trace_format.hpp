@@ -0,0 +1,54 @@
+// include/trace_format.hpp
+#pragma once
+
+#include <cstdint>
+
+// On-disk layout of a binary trace written by TraceWriter. Plain structs only, so offline tools
+// can read a trace without linking the profiler.
+//
+//   TraceFileHeader
+//   (TraceChunkHeader, TraceEvent[eventCount])*     in drain order, not time order
+//   TraceSectionRecord + name/file/function bytes   once per section, at sectionTableOffset
+
+static const char TRACE_FILE_MAGIC[8] = { 'P', 'R', 'O', 'F', 'T', 'R', 'C', '1' };
+static const uint32_t TRACE_FILE_VERSION = 1;
+static const uint32_t TRACE_CHUNK_MAGIC = 0x4b4e4843; // "CHNK"
+
+struct TraceFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;          // sizeof(TraceFileHeader), for forward compatibility
+    double secondsPerTick;        // Clock calibration at trace start
+    uint64_t clockStartTicks;     // Tick value the profiler treats as time zero
+    uint64_t sectionTableOffset;  // 0 if the process died before StopTrace
+    uint32_t sectionCount;
+    uint32_t threadCount;
+    uint64_t droppedEvents;       // Events lost because every chunk was waiting to be written
+};
+
+struct TraceChunkHeader {
+    uint32_t magic;
+    uint32_t threadIndex;         // ThreadProfilerData::threadIndex of the recording thread
+    uint64_t sequence;            // Per-thread chunk number; orders a thread's chunks
+    uint32_t eventCount;
+    uint32_t reserved;
+};
+
+// One completed section call, written at exit time
+struct TraceEvent {
+    uint64_t startTicks;
+    uint64_t endTicks;
+    int32_t sectionId;
+    int32_t parentSectionId;      // Enclosing section on the same thread, -1 at top level
+    uint32_t depth;               // Number of enclosing sections
+    uint32_t reserved;
+};
+
+struct TraceSectionRecord {
+    int32_t sectionId;
+    int32_t lineNumber;
+    uint32_t nameLength;          // Byte counts of the strings that follow, no terminators
+    uint32_t fileNameLength;
+    uint32_t functionNameLength;
+    uint32_t reserved;
+};
@@ -0,0 +1,140 @@
+#include "trace_reader.hpp"
+
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+TraceReader::TraceReader()
+    : fd(-1), mapping(nullptr), mappingSize(0), header(nullptr), eventCount(0)
+{
+}
+
+TraceReader::~TraceReader()
+{
+    Close();
+}
+
+bool TraceReader::Fail(const char* fileName, const char* reason)
+{
+    std::cerr << "Error: " << fileName << " is not a usable trace (" << reason << ")." << std::endl;
+    Close();
+    return false;
+}
+
+bool TraceReader::Open(const char* fileName)
+{
+    Close();
+
+    fd = open(fileName, O_RDONLY);
+    if (fd < 0)
+    {
+        std::cerr << "Error: Unable to open trace file " << fileName << std::endl;
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(TraceFileHeader))
+    {
+        return Fail(fileName, "too small");
+    }
+    mappingSize = (size_t)info.st_size;
+
+    void* mapped = mmap(nullptr, mappingSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED)
+    {
+        mapping = nullptr;
+        return Fail(fileName, "mmap failed");
+    }
+    mapping = static_cast<const unsigned char*>(mapped);
+    madvise(mapped, mappingSize, MADV_SEQUENTIAL);
+
+    header = reinterpret_cast<TraceFileHeader const*>(mapping);
+    if (memcmp(header->magic, TRACE_FILE_MAGIC, sizeof(header->magic)) != 0 || header->version != TRACE_FILE_VERSION)
+    {
+        return Fail(fileName, "bad magic or version");
+    }
+
+    // A trace whose writer never reached StopTrace has no section table; read chunks to the end
+    size_t chunksEnd = header->sectionTableOffset ? (size_t)header->sectionTableOffset : mappingSize;
+    if (chunksEnd > mappingSize)
+    {
+        return Fail(fileName, "section table past end of file");
+    }
+
+    size_t offset = header->headerSize;
+    while (offset + sizeof(TraceChunkHeader) <= chunksEnd)
+    {
+        TraceChunkHeader const* chunk = reinterpret_cast<TraceChunkHeader const*>(mapping + offset);
+        size_t chunkSize = sizeof(TraceChunkHeader) + (size_t)chunk->eventCount * sizeof(TraceEvent);
+        if (chunk->magic != TRACE_CHUNK_MAGIC || offset + chunkSize > chunksEnd)
+        {
+            break; // Truncated tail of an interrupted trace
+        }
+        chunks.push_back(chunk);
+        eventCount += chunk->eventCount;
+        offset += chunkSize;
+    }
+
+    offset = chunksEnd;
+    for (uint32_t i = 0; header->sectionTableOffset && i < header->sectionCount; ++i)
+    {
+        if (offset + sizeof(TraceSectionRecord) > mappingSize)
+        {
+            return Fail(fileName, "truncated section table");
+        }
+        TraceSectionRecord const* record = reinterpret_cast<TraceSectionRecord const*>(mapping + offset);
+        offset += sizeof(TraceSectionRecord);
+
+        size_t stringsSize = (size_t)record->nameLength + record->fileNameLength + record->functionNameLength;
+        if (offset + stringsSize > mappingSize || record->sectionId < 0)
+        {
+            return Fail(fileName, "truncated section table");
+        }
+        const char* strings = reinterpret_cast<const char*>(mapping + offset);
+        offset += stringsSize;
+
+        if ((size_t)record->sectionId >= sections.size())
+        {
+            sections.resize(record->sectionId + 1);
+        }
+        TraceSection& section = sections[record->sectionId];
+        section.sectionId = record->sectionId;
+        section.sectionName.assign(strings, record->nameLength);
+        section.fileName.assign(strings + record->nameLength, record->fileNameLength);
+        section.functionName.assign(strings + record->nameLength + record->fileNameLength, record->functionNameLength);
+        section.lineNumber = record->lineNumber;
+    }
+    return true;
+}
+
+void TraceReader::Close()
+{
+    if (mapping)
+    {
+        munmap(const_cast<unsigned char*>(mapping), mappingSize);
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    fd = -1;
+    mapping = nullptr;
+    mappingSize = 0;
+    header = nullptr;
+    sections.clear();
+    chunks.clear();
+    eventCount = 0;
+}
+
+const char* TraceReader::GetSectionName(int sectionId) const
+{
+    if (sectionId >= 0 && (size_t)sectionId < sections.size() && !sections[sectionId].sectionName.empty())
+    {
+        return sections[sectionId].sectionName.c_str();
+    }
+    return "Unknown";
+}
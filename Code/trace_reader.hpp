@@ -0,0 +1,49 @@
+// include/trace_reader.hpp
+#pragma once
+
+#include "trace_format.hpp"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+struct TraceSection {
+    int sectionId = -1;
+    std::string sectionName;
+    std::string fileName;
+    std::string functionName;
+    int lineNumber = 0;
+};
+
+// Read-only view of a binary trace. The file is memory-mapped, so chunks point straight into
+// the mapping and nothing is copied until a caller walks the events.
+class TraceReader {
+    public:
+        TraceReader();
+        ~TraceReader();
+
+        bool Open(const char* fileName);
+        void Close();
+
+        TraceFileHeader const& GetHeader() const { return *header; }
+        std::vector<TraceSection> const& GetSections() const { return sections; }
+        std::vector<TraceChunkHeader const*> const& GetChunks() const { return chunks; }
+        uint64_t GetEventCount() const { return eventCount; }
+
+        static TraceEvent const* GetEvents(TraceChunkHeader const* chunk)
+        {
+            return reinterpret_cast<TraceEvent const*>(chunk + 1);
+        }
+        const char* GetSectionName(int sectionId) const;
+
+    private:
+        bool Fail(const char* fileName, const char* reason);
+
+        int fd;
+        const unsigned char* mapping;
+        size_t mappingSize;
+        TraceFileHeader const* header;
+        std::vector<TraceSection> sections;          // Indexed by sectionId
+        std::vector<TraceChunkHeader const*> chunks; // In file order
+        uint64_t eventCount;
+};
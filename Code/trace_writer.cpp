@@ -0,0 +1,180 @@
+#include "trace_writer.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+TraceWriter::TraceWriter()
+    : chunkCount(0), nextChunk(0), droppedEvents(0), writtenEvents(0), file(nullptr), stopping(false)
+{
+}
+
+TraceWriter::~TraceWriter()
+{
+    if (file)
+    {
+        Close(std::vector<TraceSectionInfo>(), 0);
+    }
+}
+
+bool TraceWriter::Open(const char* fileName, size_t chunkCount, double secondsPerTick, uint64_t clockStartTicks)
+{
+    if (file)
+    {
+        std::cerr << "Error: A trace is already being written." << std::endl;
+        return false;
+    }
+
+    file = fopen(fileName, "wb");
+    if (!file)
+    {
+        std::cerr << "Error: Unable to open trace file " << fileName << std::endl;
+        return false;
+    }
+    setvbuf(file, nullptr, _IOFBF, 1 << 20);
+
+    if (chunkCount < 2)
+    {
+        chunkCount = 2;
+    }
+    if (!chunks || this->chunkCount != chunkCount)
+    {
+        chunks.reset(new TraceChunk[chunkCount]);
+        this->chunkCount = chunkCount;
+    }
+    for (size_t i = 0; i < chunkCount; ++i)
+    {
+        chunks[i].state.store(TraceChunk::Free, std::memory_order_relaxed);
+    }
+    nextChunk.store(0);
+    droppedEvents.store(0);
+    writtenEvents.store(0);
+
+    // The header is rewritten by Close once the section table offset is known
+    memset(&fileHeader, 0, sizeof(fileHeader));
+    memcpy(fileHeader.magic, TRACE_FILE_MAGIC, sizeof(fileHeader.magic));
+    fileHeader.version = TRACE_FILE_VERSION;
+    fileHeader.headerSize = sizeof(TraceFileHeader);
+    fileHeader.secondsPerTick = secondsPerTick;
+    fileHeader.clockStartTicks = clockStartTicks;
+    fwrite(&fileHeader, sizeof(fileHeader), 1, file);
+
+    stopping = false;
+    drainThread = std::thread(&TraceWriter::DrainLoop, this);
+    return true;
+}
+
+TraceChunk* TraceWriter::ExchangeChunk(TraceChunk* filled, uint32_t threadIndex, uint64_t sequence)
+{
+    if (filled)
+    {
+        SubmitChunk(filled);
+    }
+
+    // One pass over the pool, starting where the last claim left off
+    size_t start = nextChunk.fetch_add(1, std::memory_order_relaxed);
+    for (size_t i = 0; i < chunkCount; ++i)
+    {
+        TraceChunk& chunk = chunks[(start + i) % chunkCount];
+        int expected = TraceChunk::Free;
+        if (chunk.state.load(std::memory_order_relaxed) == TraceChunk::Free &&
+            chunk.state.compare_exchange_strong(expected, TraceChunk::Filling, std::memory_order_acquire))
+        {
+            chunk.header.magic = TRACE_CHUNK_MAGIC;
+            chunk.header.threadIndex = threadIndex;
+            chunk.header.sequence = sequence;
+            chunk.header.eventCount = 0;
+            chunk.header.reserved = 0;
+            return &chunk;
+        }
+    }
+    return nullptr;
+}
+
+void TraceWriter::SubmitChunk(TraceChunk* filled)
+{
+    filled->state.store(TraceChunk::Full, std::memory_order_release);
+}
+
+bool TraceWriter::DrainFullChunks()
+{
+    bool wroteAny = false;
+    for (size_t i = 0; i < chunkCount; ++i)
+    {
+        TraceChunk& chunk = chunks[i];
+        if (chunk.state.load(std::memory_order_acquire) != TraceChunk::Full)
+        {
+            continue;
+        }
+
+        fwrite(&chunk.header, sizeof(chunk.header), 1, file);
+        fwrite(chunk.events, sizeof(TraceEvent), chunk.header.eventCount, file);
+        writtenEvents.fetch_add(chunk.header.eventCount, std::memory_order_relaxed);
+        chunk.state.store(TraceChunk::Free, std::memory_order_release);
+        wroteAny = true;
+    }
+    return wroteAny;
+}
+
+void TraceWriter::DrainLoop()
+{
+    std::unique_lock<std::mutex> lock(drainMutex);
+    while (!stopping)
+    {
+        lock.unlock();
+        bool wroteAny = DrainFullChunks();
+        lock.lock();
+
+        // Instrumented threads never signal us, so poll; back off only when there was nothing to do
+        if (!wroteAny && !stopping)
+        {
+            drainWake.wait_for(lock, std::chrono::milliseconds(2));
+        }
+    }
+}
+
+void TraceWriter::Close(std::vector<TraceSectionInfo> const& sections, uint32_t threadCount)
+{
+    if (!file)
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(drainMutex);
+        stopping = true;
+    }
+    drainWake.notify_one();
+    drainThread.join();
+    DrainFullChunks(); // Whatever was submitted after the drain thread's last pass
+
+    uint64_t sectionTableOffset = (uint64_t)ftell(file);
+    for (TraceSectionInfo const& section : sections)
+    {
+        const char* name = section.sectionName ? section.sectionName : "";
+        const char* fileName = section.fileName ? section.fileName : "";
+        const char* functionName = section.functionName ? section.functionName : "";
+
+        TraceSectionRecord record;
+        record.sectionId = section.sectionId;
+        record.lineNumber = section.lineNumber;
+        record.nameLength = (uint32_t)strlen(name);
+        record.fileNameLength = (uint32_t)strlen(fileName);
+        record.functionNameLength = (uint32_t)strlen(functionName);
+        record.reserved = 0;
+        fwrite(&record, sizeof(record), 1, file);
+        fwrite(name, 1, record.nameLength, file);
+        fwrite(fileName, 1, record.fileNameLength, file);
+        fwrite(functionName, 1, record.functionNameLength, file);
+    }
+
+    fileHeader.sectionTableOffset = sectionTableOffset;
+    fileHeader.sectionCount = (uint32_t)sections.size();
+    fileHeader.threadCount = threadCount;
+    fileHeader.droppedEvents = droppedEvents.load();
+    fseek(file, 0, SEEK_SET);
+    fwrite(&fileHeader, sizeof(fileHeader), 1, file);
+
+    fclose(file);
+    file = nullptr;
+}
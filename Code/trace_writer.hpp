@@ -0,0 +1,70 @@
+// include/trace_writer.hpp
+#pragma once
+
+#include "trace_format.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const uint32_t TRACE_EVENTS_PER_CHUNK = 4096;
+
+// A fixed block of events owned by one thread at a time. State moves
+// Free -> Filling (a thread claimed it) -> Full (handed to the writer) -> Free.
+struct TraceChunk {
+    enum State { Free = 0, Filling = 1, Full = 2 };
+
+    std::atomic<int> state;
+    TraceChunkHeader header;
+    TraceEvent events[TRACE_EVENTS_PER_CHUNK];
+};
+
+struct TraceSectionInfo {
+    int sectionId;
+    const char* sectionName;
+    const char* fileName;
+    const char* functionName;
+    int lineNumber;
+};
+
+// Streams events to a binary trace file from a fixed pool of chunks. Instrumented threads only
+// claim and release chunks with atomics; a background thread writes Full chunks and frees them.
+// If the writer falls behind and no chunk is free, events are dropped and counted, never waited on.
+class TraceWriter {
+    public:
+        TraceWriter();
+        ~TraceWriter();
+
+        bool Open(const char* fileName, size_t chunkCount, double secondsPerTick, uint64_t clockStartTicks);
+        void Close(std::vector<TraceSectionInfo> const& sections, uint32_t threadCount);
+        bool IsOpen() const { return file != nullptr; }
+
+        // Hands back a filled (or nullptr) chunk and claims an empty one, nullptr if none is free
+        TraceChunk* ExchangeChunk(TraceChunk* filled, uint32_t threadIndex, uint64_t sequence);
+        void SubmitChunk(TraceChunk* filled);   // For partially filled chunks at stop time
+        void CountDroppedEvent() { droppedEvents.fetch_add(1, std::memory_order_relaxed); }
+        uint64_t GetDroppedEvents() const { return droppedEvents.load(std::memory_order_relaxed); }
+        uint64_t GetWrittenEvents() const { return writtenEvents.load(std::memory_order_relaxed); }
+
+    private:
+        void DrainLoop();
+        bool DrainFullChunks();
+
+        std::unique_ptr<TraceChunk[]> chunks;   // Allocated once per Open; this is the memory bound
+        size_t chunkCount;
+        std::atomic<size_t> nextChunk;          // Where the next free-chunk search starts
+        std::atomic<uint64_t> droppedEvents;
+        std::atomic<uint64_t> writtenEvents;
+
+        FILE* file;
+        TraceFileHeader fileHeader;
+        std::thread drainThread;
+        std::mutex drainMutex;                  // Only used by the drain thread's sleep and Close
+        std::condition_variable drainWake;
+        bool stopping;
+};
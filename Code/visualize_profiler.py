@@ -47,15 +47,15 @@ def preprocess_data(profiler_data):
     sections = pd.DataFrame(profiler_data.get('sections', []))
 
     # Ensure necessary columns exist, fill missing with default values
-    required_columns = {'sectionName', 'count', 'totalTime', 'averageTime',
-                        'minTime', 'maxTime', 'fileName', 'functionName', 'lineNumber',
+    required_columns = {'sectionName', 'count', 'totalTime', 'exclusiveTime', 'averageTime',
+                        'minTime', 'maxTime', 'p50Time', 'p90Time', 'p99Time', 'p999Time', 'fileName', 'functionName', 'lineNumber',
                         'startTime', 'endTime', 'parentSection'}
     missing_columns = required_columns - set(sections.columns)
     if missing_columns:
         logger.warning(f"Missing columns in 'sections' data: {missing_columns}. Filling with default values.")
         for col in missing_columns:
-            if col in {'count', 'totalTime', 'averageTime', 'minTime', 'maxTime',
-                       'lineNumber', 'startTime', 'endTime'}:
+            if col in {'count', 'totalTime', 'exclusiveTime', 'averageTime', 'minTime', 'maxTime',
+                       'p50Time', 'p90Time', 'p99Time', 'p999Time', 'lineNumber', 'startTime', 'endTime'}:
                 sections[col] = 0
             elif col == 'parentSection':
                 sections[col] = None
@@ -63,8 +63,8 @@ def preprocess_data(profiler_data):
                 sections[col] = 'Unknown'
 
     # Convert numeric columns to appropriate data types
-    numeric_columns = ['count', 'totalTime', 'averageTime', 'minTime', 'maxTime',
-                       'lineNumber', 'startTime', 'endTime']
+    numeric_columns = ['count', 'totalTime', 'exclusiveTime', 'averageTime', 'minTime', 'maxTime',
+                       'p50Time', 'p90Time', 'p99Time', 'p999Time', 'lineNumber', 'startTime', 'endTime']
     sections[numeric_columns] = sections[numeric_columns].apply(pd.to_numeric, errors='coerce')
 
     # Check for NaNs in numeric columns
@@ -88,6 +88,55 @@ def preprocess_data(profiler_data):
     logger.info("Successfully preprocessed profiler data.")
     return sections
 
+def preprocess_call_tree(profiler_data):
+    """Flatten the nested 'callTree' into one row per node, keyed by its path."""
+    rows = []
+
+    def visit(node, parent_id):
+        node_id = f"{parent_id}/{node.get('sectionName', 'Unknown')}" if parent_id else node.get('sectionName', 'Unknown')
+        rows.append({
+            'id': node_id,
+            'parent': parent_id,
+            'sectionName': node.get('sectionName', 'Unknown'),
+            'count': node.get('count', 0),
+            'inclusiveTime': node.get('inclusiveTime', 0),
+            'exclusiveTime': node.get('exclusiveTime', 0),
+        })
+        for child in node.get('children', []):
+            visit(child, node_id)
+
+    for root in profiler_data.get('callTree', []):
+        visit(root, '')
+
+    if not rows:
+        logger.warning("No 'callTree' in profiler data; call tree view will be empty.")
+    return pd.DataFrame(rows)
+
+def create_call_tree_chart(tree_df):
+    """Create an icicle chart where each box is a call path sized by inclusive time."""
+    logger.info("Creating call tree chart.")
+
+    if tree_df.empty:
+        return px.icicle(title='Call tree data not available')
+
+    fig = px.icicle(
+        tree_df,
+        ids='id',
+        names='sectionName',
+        parents='parent',
+        values='inclusiveTime',
+        branchvalues='total',
+        hover_data=['count', 'inclusiveTime', 'exclusiveTime']
+    )
+
+    fig.update_layout(
+        height=600,
+        margin=dict(l=50, r=50, t=50, b=50),
+        title='Call Tree (inclusive time, ms)'
+    )
+
+    return fig
+
 def create_bar_chart(sections_df, sort_by='averageTime', ascending=False, top_n=50):
     """Create a horizontal bar chart with min and max times represented as error bars."""
     logger.info(f"Creating bar chart with sort_by='{sort_by}', ascending={ascending}")
@@ -128,7 +177,8 @@ def create_bar_chart(sections_df, sort_by='averageTime', ascending=False, top_n=
         orientation='h',
         title=f'Top {top_n} Sections by {sort_by}',
         labels={'averageTime': f'{sort_by} (ms)', 'sectionName': 'Section Name'},
-        hover_data=['minTime', 'averageTime', 'maxTime', 'totalTime', 'count'],
+        hover_data=['minTime', 'averageTime', 'p50Time', 'p90Time', 'p99Time', 'p999Time',
+                    'maxTime', 'totalTime', 'exclusiveTime', 'count'],
         error_x=sorted_df['error_plus'],
         error_x_minus=sorted_df['error_minus']
     )
@@ -229,6 +279,7 @@ def generate_insights(sections_df):
 # Load and preprocess data
 profiler_data = load_profiler_data('profiler_stats.json')  # Ensure the correct JSON file path
 sections_df = preprocess_data(profiler_data)
+call_tree_df = preprocess_call_tree(profiler_data)
 
 # Define app layout
 app.layout = dbc.Container([
@@ -261,6 +312,9 @@ app.layout = dbc.Container([
                         options=[
                             {'label': 'Average Time', 'value': 'averageTime'},
                             {'label': 'Total Time', 'value': 'totalTime'},
+                            {'label': 'Exclusive Time', 'value': 'exclusiveTime'},
+                            {'label': 'p99 Time', 'value': 'p99Time'},
+                            {'label': 'p99.9 Time', 'value': 'p999Time'},
                             {'label': 'Call Count', 'value': 'count'}
                         ],
                         value='averageTime',
@@ -317,6 +371,14 @@ app.layout = dbc.Container([
                 ], width=12),
             ]),
         ]),
+        # Tab for the hierarchical call tree
+        dbc.Tab(label='Call Tree', children=[
+            dbc.Row([
+                dbc.Col([
+                    dcc.Graph(id='call-tree-chart', figure=create_call_tree_chart(call_tree_df))
+                ], width=12),
+            ]),
+        ]),
     ]),
 
     # Instructions
@@ -326,6 +388,7 @@ app.layout = dbc.Container([
             html.P("Use the input boxes to filter sections by name. Adjust the sort options to order the bar chart based on different metrics."),
             html.P("The bar chart displays the average execution time for each profiling section, with error bars representing the min and max times."),
             html.P("The execution timeline shows the start and end times of each section."),
+            html.P("The call tree shows where time goes along each nesting path; hover a box for its exclusive (self) time."),
             html.P("Automated insights provide AI-generated analysis to help identify performance bottlenecks and optimization opportunities."),
         ], width=12)
     ], style={'marginTop': 30})